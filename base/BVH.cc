@@ -0,0 +1,577 @@
+/*
+BVH.cc
+A bounding volume hierarchy over the faces of a triangle mesh, for
+finding the closest point on the surface to a given point, and for
+intersecting rays with the surface.
+
+The tree is built top-down, choosing splits using the surface area
+heuristic evaluated over a fixed number of bins along each axis:
+  Wald, I.
+  "On fast Construction of SAH-based Bounding Volume Hierarchies,"
+  Proc. IEEE Symposium on Interactive Ray Tracing, 2007.
+*/
+
+#include "trimesh2/BVH.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+
+namespace trimesh {
+
+// Build parameters
+enum { NUM_BINS = 16, MAX_TRIS_PER_LEAF = 8, MAX_DEPTH = 48 };
+
+// Relative cost of visiting an interior node vs. testing a triangle
+static const float TRAVERSAL_COST = 1.0f;
+
+
+// Half the surface area of a box, which is all the SAH needs
+static inline float half_area(const box &b)
+{
+	if (unlikely(!b.valid))
+		return 0.0f;
+	vec d = b.max - b.min;
+	return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+}
+
+
+// Squared distance from p to the box of a node (0 if inside)
+static inline float box_dist2(const float *bmin, const float *bmax,
+                              const point &p)
+{
+	float d2 = 0.0f;
+	for (int i = 0; i < 3; i++) {
+		if (p[i] < bmin[i])
+			d2 += sqr(bmin[i] - p[i]);
+		else if (p[i] > bmax[i])
+			d2 += sqr(p[i] - bmax[i]);
+	}
+	return d2;
+}
+
+
+// Closest point to p on triangle abc, returning its barycentric
+// coordinates.  Uses the Voronoi-region method from
+//  Ericson, C.
+//  "Real-Time Collision Detection," Section 5.1.5, 2005.
+static vec closest_on_tri(const point &p, const point &a,
+                          const point &b, const point &c)
+{
+	vec ab = b - a, ac = c - a, ap = p - a;
+	float d1 = ab DOT ap, d2 = ac DOT ap;
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return vec(1, 0, 0);
+
+	vec bp = p - b;
+	float d3 = ab DOT bp, d4 = ac DOT bp;
+	if (d3 >= 0.0f && d4 <= d3)
+		return vec(0, 1, 0);
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		float v = d1 / (d1 - d3);
+		return vec(1.0f - v, v, 0);
+	}
+
+	vec cp = p - c;
+	float d5 = ab DOT cp, d6 = ac DOT cp;
+	if (d6 >= 0.0f && d5 <= d6)
+		return vec(0, 0, 1);
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		float w = d2 / (d2 - d6);
+		return vec(1.0f - w, 0, w);
+	}
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		return vec(0, 1.0f - w, w);
+	}
+
+	float denom = va + vb + vc;
+	if (unlikely(!(denom > 0.0f))) {
+		// Degenerate triangle - settle for the closest vertex
+		float da = dist2(p, a), db = dist2(p, b), dc = dist2(p, c);
+		if (da <= db && da <= dc)
+			return vec(1, 0, 0);
+		return (db <= dc) ? vec(0, 1, 0) : vec(0, 0, 1);
+	}
+	float v = vb / denom, w = vc / denom;
+	return vec(1.0f - v - w, v, w);
+}
+
+
+// Intersect the ray p + t * dir with triangle abc, for tmin < t < tmax.
+// Uses the method from
+//  Moller, T. and Trumbore, B.
+//  "Fast, Minimum Storage Ray/Triangle Intersection,"
+//  Journal of Graphics Tools, Vol. 2, No. 1, 1997.
+static inline bool ray_tri(const point &p, const vec &dir,
+                           const point &a, const point &b, const point &c,
+                           float tmin, float tmax, float &t, vec &bary)
+{
+	vec e1 = b - a, e2 = c - a;
+	vec pvec = dir TRICROSS e2;
+	float det = e1 DOT pvec;
+	if (det == 0.0f)
+		return false;
+	float invdet = 1.0f / det;
+
+	vec tvec = p - a;
+	float u = (tvec DOT pvec) * invdet;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	vec qvec = tvec TRICROSS e1;
+	float v = (dir DOT qvec) * invdet;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	t = (e2 DOT qvec) * invdet;
+	if (!(t > tmin && t < tmax))
+		return false;
+	bary = vec(1.0f - u - v, u, v);
+	return true;
+}
+
+
+// Does the ray p + t * dir (with invdir = 1 / dir) overlap the box
+// for some t in (tmin, tmax)?  Returns the entry point in tenter.
+static inline bool ray_box(const point &p, const vec &invdir,
+                           const float *bmin, const float *bmax,
+                           float tmin, float tmax, float &tenter)
+{
+	for (int i = 0; i < 3; i++) {
+		float t1 = (bmin[i] - p[i]) * invdir[i];
+		float t2 = (bmax[i] - p[i]) * invdir[i];
+		if (t1 > t2)
+			swap(t1, t2);
+		// Written so that NaNs (0 * inf) leave the interval alone
+		if (t1 > tmin) tmin = t1;
+		if (t2 < tmax) tmax = t2;
+	}
+	tenter = tmin;
+	return tmin <= tmax;
+}
+
+
+// Recursively build the subtree over order[begin..end), returning the
+// index of its root node
+int BVH::build_node(vector<int> &order, int begin, int end,
+                    const vector<box> &boxes,
+                    const vector<point> &centroids, int depth)
+{
+	int n = end - begin;
+	box bounds, cbounds;
+	for (int i = begin; i < end; i++) {
+		bounds += boxes[order[i]];
+		cbounds += centroids[order[i]];
+	}
+
+	int me = nodes.size();
+	nodes.push_back(Node());
+	for (int i = 0; i < 3; i++) {
+		nodes[me].bmin[i] = bounds.min[i];
+		nodes[me].bmax[i] = bounds.max[i];
+	}
+	nodes[me].start = begin;
+	nodes[me].ntris = n;
+
+	if (n == 1 || depth >= MAX_DEPTH)
+		return me;
+
+	// Evaluate the SAH at the bin boundaries along each axis
+	vec extent = cbounds.max - cbounds.min;
+	int best_axis = -1, best_split = 0;
+	float best_cost = float(n);
+	for (int axis = 0; axis < 3; axis++) {
+		if (!(extent[axis] > 0.0f))
+			continue;
+		float scale = NUM_BINS / extent[axis];
+		box binbox[NUM_BINS];
+		int bincount[NUM_BINS] = { 0 };
+		for (int i = begin; i < end; i++) {
+			int b = int(scale *
+				(centroids[order[i]][axis] - cbounds.min[axis]));
+			b = min(b, NUM_BINS - 1);
+			bincount[b]++;
+			binbox[b] += boxes[order[i]];
+		}
+
+		// Sweep from the right, then from the left
+		float rarea[NUM_BINS];
+		int rcount[NUM_BINS];
+		box acc;
+		int count = 0;
+		for (int b = NUM_BINS - 1; b > 0; b--) {
+			acc += binbox[b];
+			count += bincount[b];
+			rarea[b] = half_area(acc);
+			rcount[b] = count;
+		}
+		acc.clear();
+		count = 0;
+		float scale_cost = 1.0f / half_area(bounds);
+		for (int b = 1; b < NUM_BINS; b++) {
+			acc += binbox[b-1];
+			count += bincount[b-1];
+			if (!count || !rcount[b])
+				continue;
+			float cost = TRAVERSAL_COST + scale_cost *
+				(half_area(acc) * count + rarea[b] * rcount[b]);
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b;
+			}
+		}
+	}
+
+	int mid;
+	if (best_axis >= 0) {
+		float scale = NUM_BINS / extent[best_axis];
+		float cmin = cbounds.min[best_axis];
+		mid = partition(order.begin() + begin, order.begin() + end,
+			[&](int f) {
+				int b = int(scale * (centroids[f][best_axis] - cmin));
+				return min(b, NUM_BINS - 1) < best_split;
+			}) - order.begin();
+	} else if (n <= MAX_TRIS_PER_LEAF) {
+		// Splitting is no cheaper than testing everything
+		return me;
+	} else {
+		// All centroids coincide, or the SAH declined a split on a
+		// big node.  Split at the median along the longest axis.
+		int axis = 0;
+		vec size = bounds.size();
+		if (size[1] > size[axis]) axis = 1;
+		if (size[2] > size[axis]) axis = 2;
+		mid = begin + n / 2;
+		nth_element(order.begin() + begin, order.begin() + mid,
+			order.begin() + end, [&](int f1, int f2) {
+				return centroids[f1][axis] < centroids[f2][axis];
+			});
+	}
+
+	nodes[me].ntris = 0;
+	build_node(order, begin, mid, boxes, centroids, depth + 1);
+	int child2 = build_node(order, mid, end, boxes, centroids, depth + 1);
+	nodes[me].start = child2;
+	return me;
+}
+
+
+// Create a BVH from lists of vertices and faces
+void BVH::build(const vector<point> &vertices,
+                const vector<TriMesh::Face> &faces)
+{
+	ptrdiff_t nf = faces.size();
+	if (!nf)
+		return;
+
+	TriMesh::dprintf("Building BVH... ");
+
+	vector<box> boxes(nf);
+	vector<point> centroids(nf);
+	vector<int> order(nf);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		const point &v0 = vertices[faces[i][0]];
+		const point &v1 = vertices[faces[i][1]];
+		const point &v2 = vertices[faces[i][2]];
+		boxes[i] = box(v0);
+		boxes[i] += v1;
+		boxes[i] += v2;
+		centroids[i] = (1.0f / 3.0f) * (v0 + v1 + v2);
+		order[i] = i;
+	}
+
+	nodes.reserve(2 * nf / MAX_TRIS_PER_LEAF + 1);
+	build_node(order, 0, nf, boxes, centroids, 0);
+
+	tris.resize(nf);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		const TriMesh::Face &f = faces[order[i]];
+		tris[i].v[0] = vertices[f[0]];
+		tris[i].v[1] = vertices[f[1]];
+		tris[i].v[2] = vertices[f[2]];
+		tris[i].face = order[i];
+	}
+
+	TriMesh::dprintf("Done.  %d nodes.\n", (int) nodes.size());
+}
+
+
+// Return the closest point on the surface to p
+bool BVH::closest_pt(const point &p, SurfacePoint &result,
+                     float maxdist2 /* = 0.0f */) const
+{
+	result.face = -1;
+	if (nodes.empty())
+		return false;
+
+	float best_d2 = (maxdist2 > 0.0f) ? maxdist2 : HUGE_VALF;
+	int best_tri = -1;
+	vec best_bary;
+
+	// Depth is bounded during construction, so the stack can't overflow
+	int stack[MAX_DEPTH + 2];
+	int nstack = 0;
+	stack[nstack++] = 0;
+	while (nstack) {
+		const Node &node = nodes[stack[--nstack]];
+		if (box_dist2(node.bmin, node.bmax, p) >= best_d2)
+			continue;
+
+		if (node.ntris) {
+			for (int i = node.start; i < node.start + node.ntris; i++) {
+				const Tri &t = tris[i];
+				vec bary = closest_on_tri(p, t.v[0], t.v[1], t.v[2]);
+				point q = bary[0] * t.v[0] + bary[1] * t.v[1] +
+				          bary[2] * t.v[2];
+				float d2 = dist2(p, q);
+				if (d2 < best_d2) {
+					best_d2 = d2;
+					best_tri = i;
+					best_bary = bary;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first
+		int c1 = &node - &nodes[0] + 1, c2 = node.start;
+		float d1 = box_dist2(nodes[c1].bmin, nodes[c1].bmax, p);
+		float d2 = box_dist2(nodes[c2].bmin, nodes[c2].bmax, p);
+		if (d1 > d2) {
+			swap(c1, c2);
+			swap(d1, d2);
+		}
+		if (d2 < best_d2)
+			stack[nstack++] = c2;
+		if (d1 < best_d2)
+			stack[nstack++] = c1;
+	}
+
+	if (best_tri < 0)
+		return false;
+
+	const Tri &t = tris[best_tri];
+	result.face = t.face;
+	result.bary = best_bary;
+	result.pos = best_bary[0] * t.v[0] + best_bary[1] * t.v[1] +
+	             best_bary[2] * t.v[2];
+	result.dist2 = best_d2;
+	return true;
+}
+
+
+// Visit the leaf triangles whose boxes are crossed by the ray, nearer
+// boxes first.  The visitor is called as visit(tri_index, t, bary) for
+// each intersection, and may shorten tmax or return true to stop.
+template <class Visitor>
+inline void BVH::traverse_ray(const point &p, const vec &dir, float tmin,
+                              float &tmax, Visitor &visit) const
+{
+	if (nodes.empty())
+		return;
+
+	vec invdir(1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]);
+	int stack[MAX_DEPTH + 2];
+	int nstack = 0;
+	float tenter;
+	if (!ray_box(p, invdir, nodes[0].bmin, nodes[0].bmax,
+	             tmin, tmax, tenter))
+		return;
+	stack[nstack++] = 0;
+	while (nstack) {
+		const Node &node = nodes[stack[--nstack]];
+		if (!ray_box(p, invdir, node.bmin, node.bmax,
+		             tmin, tmax, tenter))
+			continue;
+
+		if (node.ntris) {
+			for (int i = node.start; i < node.start + node.ntris; i++) {
+				const Tri &tri = tris[i];
+				float t;
+				vec bary;
+				if (ray_tri(p, dir, tri.v[0], tri.v[1], tri.v[2],
+				            tmin, tmax, t, bary) &&
+				    visit(i, t, bary))
+					return;
+			}
+			continue;
+		}
+
+		int c1 = &node - &nodes[0] + 1, c2 = node.start;
+		float t1, t2;
+		bool hit1 = ray_box(p, invdir, nodes[c1].bmin, nodes[c1].bmax,
+		                    tmin, tmax, t1);
+		bool hit2 = ray_box(p, invdir, nodes[c2].bmin, nodes[c2].bmax,
+		                    tmin, tmax, t2);
+		if (hit1 && hit2 && t2 < t1)
+			swap(c1, c2);
+		else if (!hit1)
+			c1 = -1;
+		else if (!hit2)
+			c2 = -1;
+		if (c2 >= 0)
+			stack[nstack++] = c2;
+		if (c1 >= 0)
+			stack[nstack++] = c1;
+	}
+}
+
+
+// Find the first intersection of the ray with the surface, returning
+// the index (in tris) of the triangle hit, or -1
+int BVH::first_hit_tri(const point &p, const vec &dir, float tmin,
+                       float &tmax, vec &bary) const
+{
+	int best_tri = -1;
+	auto visit = [&](int i, float t, const vec &b) {
+		tmax = t;
+		best_tri = i;
+		bary = b;
+		return false;
+	};
+	traverse_ray(p, dir, tmin, tmax, visit);
+	return best_tri;
+}
+
+
+// Find the first intersection of the ray with the surface
+bool BVH::first_hit(const point &p, const vec &dir, RayHit &hit,
+                    float tmin /* = 0.0f */, float tmax /* = 0.0f */) const
+{
+	hit.face = -1;
+	if (tmax <= 0.0f)
+		tmax = HUGE_VALF;
+
+	int i = first_hit_tri(p, dir, tmin, tmax, hit.bary);
+	if (i < 0)
+		return false;
+	hit.face = tris[i].face;
+	hit.t = tmax;
+	return true;
+}
+
+
+// Is there any intersection along the ray?
+bool BVH::any_hit(const point &p, const vec &dir,
+                  float tmin /* = 0.0f */, float tmax /* = 0.0f */) const
+{
+	if (tmax <= 0.0f)
+		tmax = HUGE_VALF;
+
+	bool found = false;
+	auto visit = [&](int, float, const vec &) {
+		found = true;
+		return true;
+	};
+	traverse_ray(p, dir, tmin, tmax, visit);
+	return found;
+}
+
+
+// Find all intersections along the ray
+void BVH::all_hits(const point &p, const vec &dir, vector<RayHit> &hits,
+                   float tmin /* = 0.0f */, float tmax /* = 0.0f */) const
+{
+	hits.clear();
+	if (tmax <= 0.0f)
+		tmax = HUGE_VALF;
+
+	auto visit = [&](int i, float t, const vec &bary) {
+		RayHit h;
+		h.face = tris[i].face;
+		h.bary = bary;
+		h.t = t;
+		hits.push_back(h);
+		return false;
+	};
+	traverse_ray(p, dir, tmin, tmax, visit);
+
+	sort(hits.begin(), hits.end(),
+		[](const RayHit &h1, const RayHit &h2) { return h1.t < h2.t; });
+}
+
+
+// First intersections for many rays, in parallel
+size_t BVH::first_hits(const vector<point> &ps, const vector<vec> &dirs,
+                       vector<RayHit> &hits,
+                       float tmin /* = 0.0f */, float tmax /* = 0.0f */) const
+{
+	ptrdiff_t n = ps.size();
+	hits.resize(n);
+	size_t found = 0;
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:found)
+	for (ptrdiff_t i = 0; i < n; i++) {
+		if (first_hit(ps[i], dirs[i], hits[i], tmin, tmax))
+			found++;
+	}
+	return found;
+}
+
+
+// Occlusion tests for many rays, in parallel
+size_t BVH::any_hits(const vector<point> &ps, const vector<vec> &dirs,
+                     vector<bool> &hit,
+                     float tmin /* = 0.0f */, float tmax /* = 0.0f */) const
+{
+	// vector<bool> packs bits, so can't be written from several threads
+	ptrdiff_t n = ps.size();
+	vector<unsigned char> tmp(n);
+#pragma omp parallel for schedule(dynamic, 64)
+	for (ptrdiff_t i = 0; i < n; i++)
+		tmp[i] = any_hit(ps[i], dirs[i], tmin, tmax);
+
+	hit.resize(n);
+	size_t found = 0;
+	for (ptrdiff_t i = 0; i < n; i++) {
+		hit[i] = tmp[i];
+		found += tmp[i];
+	}
+	return found;
+}
+
+
+// Is p inside the surface?
+bool BVH::inside(const point &p) const
+{
+	// An arbitrary direction, to make grazing an edge unlikely
+	const vec dir(0.5773f, 0.5774f, 0.5775f);
+	float tmax = HUGE_VALF;
+	vec bary;
+	int i = first_hit_tri(p, dir, 0.0f, tmax, bary);
+	if (i < 0)
+		return false;
+
+	const Tri &tri = tris[i];
+	vec n = (tri.v[1] - tri.v[0]) TRICROSS (tri.v[2] - tri.v[0]);
+	return (n DOT dir) > 0.0f;
+}
+
+
+// Find closest points for many query points, in parallel
+size_t BVH::closest_pts(const vector<point> &pts,
+                        vector<SurfacePoint> &results,
+                        float maxdist2 /* = 0.0f */) const
+{
+	ptrdiff_t n = pts.size();
+	results.resize(n);
+	size_t found = 0;
+#pragma omp parallel for reduction(+:found)
+	for (ptrdiff_t i = 0; i < n; i++) {
+		if (closest_pt(pts[i], results[i], maxdist2))
+			found++;
+	}
+	return found;
+}
+
+} // namespace trimesh
@@ -0,0 +1,365 @@
+/*
+CornerTable.cc
+Corner-table connectivity for a triangle mesh, with local edits.
+*/
+
+#include "trimesh2/CornerTable.h"
+#include <algorithm>
+#include <climits>
+#include <assert.h>
+using namespace std;
+
+
+namespace trimesh {
+
+// Build the table from across_edge
+CornerTable::CornerTable(TriMesh *mesh_) : mesh(mesh_), ndeleted(0)
+{
+	mesh->need_faces();
+	mesh->need_across_edge();
+	generation = mesh->topology_generation;
+	const vector<TriMesh::Face> &faces = mesh->faces;
+	const vector<TriMesh::Face> &across_edge = mesh->across_edge;
+	ptrdiff_t nv = mesh->vertices.size(), nf = faces.size();
+
+	// Corners are ints
+	if (nf > INT_MAX / 3) {
+		TriMesh::eprintf("CornerTable: too many faces (%ld)\n", (long) nf);
+		vcorner.resize(nv, -1);
+		return;
+	}
+
+	TriMesh::dprintf("Building corner table... ");
+
+	// Only pair up corners if the faces agree that they are neighbors,
+	// so that opposite(opposite(c)) == c even on non-manifold edges.
+	opp.resize(3 * nf, -1);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			int other = across_edge[i][j];
+			if (other < 0)
+				continue;
+			int v1 = faces[i][NEXT_MOD3(j)];
+			int v2 = faces[i][PREV_MOD3(j)];
+			for (int k = 0; k < 3; k++) {
+				if (faces[other][NEXT_MOD3(k)] == v2 &&
+				    faces[other][PREV_MOD3(k)] == v1 &&
+				    across_edge[other][k] == i) {
+					opp[3*i+j] = 3*other+k;
+					break;
+				}
+			}
+		}
+	}
+
+	// Start each vertex at a boundary corner, if it has one
+	vcorner.resize(nv, -1);
+	for (int c = 3 * nf - 1; c >= 0; c--)
+		vcorner[vertex(c)] = c;
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nv; i++)
+		fix_vcorner(i, vcorner[i]);
+
+	TriMesh::dprintf("Done.\n");
+}
+
+
+// Set the starting corner of v, given any corner c of v: walk backwards
+// around v until hitting the boundary (or getting back to c).
+void CornerTable::fix_vcorner(int v, int c)
+{
+	int start = c, n = opp.size();
+	for (int i = 0; c >= 0 && i < n; i++) {
+		int u = unswing(c);
+		if (u < 0 || u == start)
+			break;
+		c = u;
+	}
+	vcorner[v] = c;
+}
+
+
+// Find the corner of face f at vertex v, or -1 if f is gone or doesn't
+// contain v
+int CornerTable::find_corner(int f, int v) const
+{
+	if (f < 0 || is_deleted(f))
+		return -1;
+	int j = mesh->faces[f].indexof(v);
+	return (j < 0) ? -1 : 3 * f + j;
+}
+
+
+// After an edit, throw away anything in the mesh that depends on it.
+// The table itself is still current.
+void CornerTable::invalidate()
+{
+	mesh->changed_topology();
+	generation = mesh->topology_generation;
+}
+
+
+// Find all the corners around v, in swing order
+void CornerTable::corners_around(int v, vector<int> &corners) const
+{
+	corners.clear();
+	int c0 = vcorner[v], c = c0;
+	while (c >= 0) {
+		corners.push_back(c);
+		c = swing(c);
+		if (c == c0)
+			break;
+	}
+}
+
+
+// Flip the edge facing corner c.  The faces (a,b,d) and (e,d,b) become
+// (a,b,e) and (e,d,a).
+bool CornerTable::flip(int c)
+{
+	assert(up_to_date());
+	int o = opp[c];
+	if (o < 0)
+		return false;
+	int cn = next(c), cp = prev(c), on = next(o), op = prev(o);
+	int a = vertex(c), b = vertex(cn), d = vertex(cp), e = vertex(o);
+	if (a == e)
+		return false;
+
+	// Don't create an edge that already exists
+	vector<int> around;
+	corners_around(a, around);
+	for (size_t i = 0; i < around.size(); i++) {
+		if (vertex(next(around[i])) == e ||
+		    vertex(prev(around[i])) == e)
+			return false;
+	}
+
+	int ob = opp[on], od = opp[cn];
+	mesh->faces[face(cp)][cp % 3] = e;
+	mesh->faces[face(op)][op % 3] = a;
+	set_opp(c, ob);
+	set_opp(o, od);
+	set_opp(cn, on);
+
+	fix_vcorner(a, c);
+	fix_vcorner(b, cn);
+	fix_vcorner(d, on);
+	fix_vcorner(e, o);
+
+	invalidate();
+	return true;
+}
+
+
+// Split the edge facing corner c.  The faces (a,b,d) and (e,d,b) become
+// (a,b,m), (a,m,d), (e,d,m) and (e,m,b).
+int CornerTable::split(int c, const point &p)
+{
+	assert(up_to_date());
+	vector<TriMesh::Face> &faces = mesh->faces;
+	int o = opp[c];
+	int cn = next(c), cp = prev(c);
+	int a = vertex(c), b = vertex(cn), d = vertex(cp);
+	int od = opp[cn];
+
+	// The new vertex, with interpolated per-vertex properties
+	int m = mesh->vertices.size();
+	mesh->vertices.push_back(p);
+	if (mesh->colors.size() == size_t(m))
+		mesh->colors.push_back(0.5f * (mesh->colors[b] +
+		                               mesh->colors[d]));
+	if (mesh->confidences.size() == size_t(m))
+		mesh->confidences.push_back(0.5f * (mesh->confidences[b] +
+		                                    mesh->confidences[d]));
+	if (mesh->flags.size() == size_t(m))
+		mesh->flags.push_back(0);
+	vcorner.push_back(-1);
+
+	// (a,b,d) -> (a,b,m) + (a,m,d)
+	int c3 = 3 * faces.size();
+	faces[face(cp)][cp % 3] = m;
+	faces.push_back(TriMesh::Face(a, m, d));
+	opp.resize(opp.size() + 3, -1);
+	set_opp(c3 + 1, od);
+	set_opp(c3 + 2, cn);
+	opp[c] = opp[c3] = -1;
+
+	if (o >= 0) {
+		// (e,d,b) -> (e,d,m) + (e,m,b)
+		int on = next(o), op = prev(o);
+		int e = vertex(o);
+		int ob = opp[on];
+		int c4 = 3 * faces.size();
+		faces[face(op)][op % 3] = m;
+		faces.push_back(TriMesh::Face(e, m, b));
+		opp.resize(opp.size() + 3, -1);
+		set_opp(c4 + 1, ob);
+		set_opp(c4 + 2, on);
+		set_opp(c, c4);
+		set_opp(c3, o);
+		fix_vcorner(e, o);
+	}
+
+	fix_vcorner(a, c);
+	fix_vcorner(b, cn);
+	fix_vcorner(d, c3 + 2);
+	fix_vcorner(m, cp);
+
+	invalidate();
+	return m;
+}
+
+
+// Collapse the edge facing corner c.  The faces (a,b,d) and (e,d,b) are
+// deleted, and d is merged into b.
+bool CornerTable::collapse(int c, const point &p)
+{
+	assert(up_to_date());
+	int o = opp[c];
+	int cn = next(c), cp = prev(c);
+	int a = vertex(c), b = vertex(cn), d = vertex(cp);
+	int e = (o >= 0) ? vertex(o) : -1;
+
+	// Interior edges can't connect two boundary vertices
+	if (o >= 0 && is_bdy(b) && is_bdy(d))
+		return false;
+
+	// Link condition: the only vertices adjacent to both b and d must be
+	// the ones on the faces being deleted
+	vector<int> around_b, around_d;
+	corners_around(b, around_b);
+	corners_around(d, around_d);
+	vector<int> ring_b, ring_d;
+	for (size_t i = 0; i < around_b.size(); i++) {
+		ring_b.push_back(vertex(next(around_b[i])));
+		ring_b.push_back(vertex(prev(around_b[i])));
+	}
+	for (size_t i = 0; i < around_d.size(); i++) {
+		ring_d.push_back(vertex(next(around_d[i])));
+		ring_d.push_back(vertex(prev(around_d[i])));
+	}
+	sort(ring_b.begin(), ring_b.end());
+	sort(ring_d.begin(), ring_d.end());
+	ring_b.erase(unique(ring_b.begin(), ring_b.end()), ring_b.end());
+	ring_d.erase(unique(ring_d.begin(), ring_d.end()), ring_d.end());
+	vector<int> common;
+	set_intersection(ring_b.begin(), ring_b.end(),
+	                 ring_d.begin(), ring_d.end(),
+	                 back_inserter(common));
+	for (size_t i = 0; i < common.size(); i++) {
+		if (common[i] != a && common[i] != e)
+			return false;
+	}
+
+	// Glue together the outer neighbors of the deleted faces
+	int f1 = face(c), f2 = (o >= 0) ? face(o) : -1;
+	int od = opp[cn], oa = opp[cp];
+	int ob = (o >= 0) ? opp[next(o)] : -1;
+	int oe = (o >= 0) ? opp[prev(o)] : -1;
+	if (od >= 0) opp[od] = oa;
+	if (oa >= 0) opp[oa] = od;
+	if (o >= 0) {
+		if (ob >= 0) opp[ob] = oe;
+		if (oe >= 0) opp[oe] = ob;
+	}
+
+	// Merge d into b
+	vector<TriMesh::Face> &faces = mesh->faces;
+	for (size_t i = 0; i < around_d.size(); i++) {
+		int k = around_d[i];
+		if (face(k) != f1 && face(k) != f2)
+			faces[face(k)][k % 3] = b;
+	}
+	mesh->vertices[b] = p;
+
+	// Delete the faces
+	faces[f1] = TriMesh::Face(-1, -1, -1);
+	opp[3*f1] = opp[3*f1+1] = opp[3*f1+2] = -1;
+	ndeleted++;
+	if (f2 >= 0) {
+		faces[f2] = TriMesh::Face(-1, -1, -1);
+		opp[3*f2] = opp[3*f2+1] = opp[3*f2+2] = -1;
+		ndeleted++;
+	}
+
+	// Find new starting corners for the surviving vertices
+	int fa1 = (oa >= 0) ? face(oa) : -1, fa2 = (od >= 0) ? face(od) : -1;
+	int hint = find_corner(fa1, a);
+	if (hint < 0)
+		hint = find_corner(fa2, a);
+	vcorner[a] = -1;
+	fix_vcorner(a, hint);
+
+	hint = find_corner(fa1, b);
+	if (hint < 0)
+		hint = find_corner(fa2, b);
+	if (o >= 0) {
+		int fe1 = (ob >= 0) ? face(ob) : -1;
+		int fe2 = (oe >= 0) ? face(oe) : -1;
+		if (hint < 0)
+			hint = find_corner(fe1, b);
+		if (hint < 0)
+			hint = find_corner(fe2, b);
+		int ehint = find_corner(fe1, e);
+		if (ehint < 0)
+			ehint = find_corner(fe2, e);
+		vcorner[e] = -1;
+		fix_vcorner(e, ehint);
+	}
+	vcorner[b] = -1;
+	fix_vcorner(b, hint);
+	vcorner[d] = -1;
+
+	invalidate();
+	return true;
+}
+
+
+// Remove the deleted faces, renumbering the corners
+void CornerTable::compact()
+{
+	assert(up_to_date());
+	if (!ndeleted)
+		return;
+
+	vector<TriMesh::Face> &faces = mesh->faces;
+	ptrdiff_t nf = faces.size(), nv = vcorner.size();
+	vector<int> remap(nf, -1);
+	int next_face = 0;
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		if (!is_deleted(i))
+			remap[i] = next_face++;
+	}
+
+	vector<int> newopp(3 * next_face);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		if (remap[i] < 0)
+			continue;
+		for (int j = 0; j < 3; j++) {
+			int o = opp[3*i+j];
+			newopp[3*remap[i]+j] = (o < 0) ? -1 :
+				3 * remap[face(o)] + o % 3;
+		}
+	}
+	opp.swap(newopp);
+
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nv; i++) {
+		int c = vcorner[i];
+		if (c >= 0)
+			vcorner[i] = 3 * remap[face(c)] + c % 3;
+	}
+
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		if (remap[i] >= 0)
+			faces[remap[i]] = faces[i];
+	}
+	faces.resize(next_face);
+	ndeleted = 0;
+	invalidate();
+}
+
+} // namespace trimesh
@@ -15,8 +15,36 @@ a given point, or to a ray).
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
 using namespace std;
 
+// SIMD distance kernels for scanning leaves.  SSE is part of the baseline
+// instruction set on all x86-64 targets, and NEON on all AArch64 ones, so
+// these are selected at compile time; anything else uses the scalar loop.
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  include <xmmintrin.h>
+#  define KDTREE_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define KDTREE_NEON
+#endif
+
+// Define KDTREE_STATS to count the work done by queries (see stats()).
+// The counters live in each query's Traversal_Info, so the recursion
+// only touches thread-local data.
+#ifdef KDTREE_STATS
+#  define KDTREE_COUNT(ti, counter, n) ((ti).stats.counter += (n))
+#  define KDTREE_RECORD(ti) \
+	do { if (counters) counters->record((ti).stats); } while (0)
+#else
+#  define KDTREE_COUNT(ti, counter, n) ((void) 0)
+#  define KDTREE_RECORD(ti) ((void) 0)
+#endif
+
 #if defined(_MSC_VER)
 #  define inline __forceinline
 #elif defined(__GNUC__) && (__GNUC__ > 3)
@@ -56,6 +84,7 @@ struct KDtree::Node {
 	// tree, so we don't have to pass tons of variables at each fcn call
 	struct Traversal_Info {
 		const float *p;
+		const float *leaf_coords;
 		float closest_d2, closest_d;
 		const float *closest;
 		const float *dir;
@@ -63,14 +92,29 @@ struct KDtree::Node {
 		vector<pt_with_d> knn;
 		size_t k;
 		float approx_multiplier;
+		size_t max_leaves;
+		KDtree::QueryStats stats;
 	};
 
 	enum { MAX_PTS_PER_NODE = 8 };
 
+	// A node together with a lower bound on the distance from the query
+	// to any point inside it, for best-bin-first priority queues
+	typedef pair<float, const Node *> node_with_d;
+
 	// The node itself
 
 	int npts; // If this is 0, intermediate node.  If nonzero, leaf.
 
+	// For leaves, the coordinates of the points are also copied into
+	// the tree's leaf_coords, split by axis so that a whole leaf can be
+	// scanned at once: x, y, and z for this leaf start at entry
+	// coords * COORDS_PER_LEAF, and unused slots are zero.  Keeping them
+	// out of the union leaves interior nodes (and the Node) the same
+	// size, since this fits in what would otherwise be padding.
+	unsigned coords;
+	enum { COORDS_PER_LEAF = 3 * MAX_PTS_PER_NODE };
+
 	union {
 		struct {
 			float center[3];
@@ -85,6 +129,10 @@ struct KDtree::Node {
 
 	static Node *alloc(KDtree *kd);
 	void build(KDtree *kd, const float **pts, size_t n);
+	unsigned leaf_closer_to_pt(const Traversal_Info &ti, float thresh2,
+	                           float *d2) const;
+	unsigned leaf_closer_to_ray(const Traversal_Info &ti, float thresh2,
+	                            float *d2) const;
 	void find_closest_to_pt(Traversal_Info &ti) const;
 	void find_closest_compat_to_pt(Traversal_Info &ti) const;
 	void find_closest_to_ray(Traversal_Info &ti) const;
@@ -92,6 +140,111 @@ struct KDtree::Node {
 	void find_k_closest_to_pt(Traversal_Info &ti) const;
 	void find_k_closest_compat_to_pt(Traversal_Info &ti) const;
 	bool exists_pt(Traversal_Info &ti) const;
+	void scan_leaf_closest(Traversal_Info &ti) const;
+	void scan_leaf_k_closest(Traversal_Info &ti) const;
+	void find_closest_to_pt_bbf(Traversal_Info &ti) const;
+	void find_k_closest_to_pt_bbf(Traversal_Info &ti) const;
+	void collect_stats(KDtree::Stats &s, size_t depth) const;
+};
+
+
+// Running totals of the work done by queries, if KDTREE_STATS is defined.
+// Each thread adds into its own slot, which only it writes (so the
+// atomics are plain loads and stores, not read-modify-writes), and
+// stats() adds up the slots.  Resetting records the current totals as a
+// baseline instead of touching the slots.
+struct KDtree::Counters {
+	enum { QUERIES, NODES_VISITED, LEAVES_VISITED, POINTS_TESTED,
+	       NODES_PRUNED, NCOUNTERS };
+	struct Slot {
+		atomic<size_t> n[NCOUNTERS];
+		char pad[64]; // Keep other threads' slots off this cache line
+		Slot() { for (int i = 0; i < NCOUNTERS; i++) n[i] = 0; }
+	};
+
+	size_t id; // Unique to this Counters, for the per-thread cache
+	mutex slots_mutex;
+	vector< pair<thread::id, Slot *> > slots;
+	size_t base[NCOUNTERS];
+
+	Counters()
+	{
+		static atomic<size_t> next_id(1);
+		id = next_id.fetch_add(1);
+		for (int i = 0; i < NCOUNTERS; i++)
+			base[i] = 0;
+	}
+	~Counters()
+	{
+		for (size_t i = 0; i < slots.size(); i++)
+			delete slots[i].second;
+	}
+
+	// This thread's slot.  The lock is only taken the first time each
+	// thread records into a given tree (or after it has recorded into
+	// another one).
+	Slot &slot()
+	{
+		static thread_local size_t cached_id = 0;
+		static thread_local Slot *cached = NULL;
+		if (cached_id == id)
+			return *cached;
+
+		lock_guard<mutex> lock(slots_mutex);
+		thread::id me = this_thread::get_id();
+		Slot *s = NULL;
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (slots[i].first == me) {
+				s = slots[i].second;
+				break;
+			}
+		}
+		if (!s) {
+			s = new Slot;
+			slots.push_back(make_pair(me, s));
+		}
+		cached_id = id;
+		cached = s;
+		return *s;
+	}
+
+	static void bump(atomic<size_t> &c, size_t n)
+	{
+		c.store(c.load(memory_order_relaxed) + n, memory_order_relaxed);
+	}
+
+	// Called once at the end of each query
+	void record(const KDtree::QueryStats &qs)
+	{
+		Slot &s = slot();
+		bump(s.n[QUERIES], 1);
+		bump(s.n[NODES_VISITED], qs.nodes_visited);
+		bump(s.n[LEAVES_VISITED], qs.leaves_visited);
+		bump(s.n[POINTS_TESTED], qs.points_tested);
+		bump(s.n[NODES_PRUNED], qs.nodes_pruned);
+	}
+
+	// Totals over all threads, since the last reset
+	void totals(size_t (&t)[NCOUNTERS])
+	{
+		lock_guard<mutex> lock(slots_mutex);
+		for (int i = 0; i < NCOUNTERS; i++)
+			t[i] = 0;
+		for (size_t j = 0; j < slots.size(); j++)
+			for (int i = 0; i < NCOUNTERS; i++)
+				t[i] += slots[j].second->n[i].load(memory_order_relaxed);
+		for (int i = 0; i < NCOUNTERS; i++)
+			t[i] -= base[i];
+	}
+
+	void reset()
+	{
+		size_t t[NCOUNTERS];
+		totals(t);
+		lock_guard<mutex> lock(slots_mutex);
+		for (int i = 0; i < NCOUNTERS; i++)
+			base[i] += t[i];
+	}
 };
 
 
@@ -145,6 +298,122 @@ inline KDtree::Node *KDtree::Node::alloc(KDtree *kd)
 }
 
 
+// Compute the squared distances from p to all the points in a leaf,
+// storing them in d2.  Returns a bitmask of the points with d2 < thresh2.
+inline unsigned KDtree::Node::leaf_closer_to_pt(const Traversal_Info &ti,
+	float thresh2, float *d2) const
+{
+	const float *p = ti.p;
+	const float *x = ti.leaf_coords + size_t(coords) * COORDS_PER_LEAF;
+	const float *y = x + MAX_PTS_PER_NODE, *z = y + MAX_PTS_PER_NODE;
+	unsigned mask = 0;
+#if defined(KDTREE_SSE)
+	const __m128 px = _mm_set1_ps(p[0]), py = _mm_set1_ps(p[1]),
+	             pz = _mm_set1_ps(p[2]), t = _mm_set1_ps(thresh2);
+	for (int i = 0; i < MAX_PTS_PER_NODE; i += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), px);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), py);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), pz);
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+		                                 _mm_mul_ps(dy, dy)),
+		                      _mm_mul_ps(dz, dz));
+		_mm_storeu_ps(d2 + i, d);
+		mask |= unsigned(_mm_movemask_ps(_mm_cmplt_ps(d, t))) << i;
+	}
+#elif defined(KDTREE_NEON)
+	const float32x4_t px = vdupq_n_f32(p[0]), py = vdupq_n_f32(p[1]),
+	                  pz = vdupq_n_f32(p[2]), t = vdupq_n_f32(thresh2);
+	for (int i = 0; i < MAX_PTS_PER_NODE; i += 4) {
+		float32x4_t dx = vsubq_f32(vld1q_f32(x + i), px);
+		float32x4_t dy = vsubq_f32(vld1q_f32(y + i), py);
+		float32x4_t dz = vsubq_f32(vld1q_f32(z + i), pz);
+		float32x4_t d = vaddq_f32(vaddq_f32(vmulq_f32(dx, dx),
+		                                    vmulq_f32(dy, dy)),
+		                          vmulq_f32(dz, dz));
+		vst1q_f32(d2 + i, d);
+		uint32x4_t lt = vcltq_f32(d, t);
+		mask |= ((vgetq_lane_u32(lt, 0) & 1u) |
+		         (vgetq_lane_u32(lt, 1) & 2u) |
+		         (vgetq_lane_u32(lt, 2) & 4u) |
+		         (vgetq_lane_u32(lt, 3) & 8u)) << i;
+	}
+#else
+	for (int i = 0; i < MAX_PTS_PER_NODE; i++) {
+		d2[i] = sqr(x[i] - p[0]) + sqr(y[i] - p[1]) +
+		        sqr(z[i] - p[2]);
+		if (d2[i] < thresh2)
+			mask |= 1u << i;
+	}
+#endif
+	return mask & ((1u << npts) - 1);
+}
+
+
+// Same as above, but for squared distances to the line through p in
+// the (unit-length) direction dir
+inline unsigned KDtree::Node::leaf_closer_to_ray(const Traversal_Info &ti,
+	float thresh2, float *d2) const
+{
+	const float *p = ti.p, *dir = ti.dir;
+	const float *x = ti.leaf_coords + size_t(coords) * COORDS_PER_LEAF;
+	const float *y = x + MAX_PTS_PER_NODE, *z = y + MAX_PTS_PER_NODE;
+	unsigned mask = 0;
+#if defined(KDTREE_SSE)
+	const __m128 px = _mm_set1_ps(p[0]), py = _mm_set1_ps(p[1]),
+	             pz = _mm_set1_ps(p[2]), t = _mm_set1_ps(thresh2);
+	const __m128 ux = _mm_set1_ps(dir[0]), uy = _mm_set1_ps(dir[1]),
+	             uz = _mm_set1_ps(dir[2]);
+	for (int i = 0; i < MAX_PTS_PER_NODE; i += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), px);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), py);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), pz);
+		__m128 l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+		                                  _mm_mul_ps(dy, dy)),
+		                       _mm_mul_ps(dz, dz));
+		__m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ux),
+		                                     _mm_mul_ps(dy, uy)),
+		                          _mm_mul_ps(dz, uz));
+		__m128 d = _mm_sub_ps(l2, _mm_mul_ps(along, along));
+		_mm_storeu_ps(d2 + i, d);
+		mask |= unsigned(_mm_movemask_ps(_mm_cmplt_ps(d, t))) << i;
+	}
+#elif defined(KDTREE_NEON)
+	const float32x4_t px = vdupq_n_f32(p[0]), py = vdupq_n_f32(p[1]),
+	                  pz = vdupq_n_f32(p[2]), t = vdupq_n_f32(thresh2);
+	const float32x4_t ux = vdupq_n_f32(dir[0]), uy = vdupq_n_f32(dir[1]),
+	                  uz = vdupq_n_f32(dir[2]);
+	for (int i = 0; i < MAX_PTS_PER_NODE; i += 4) {
+		float32x4_t dx = vsubq_f32(vld1q_f32(x + i), px);
+		float32x4_t dy = vsubq_f32(vld1q_f32(y + i), py);
+		float32x4_t dz = vsubq_f32(vld1q_f32(z + i), pz);
+		float32x4_t l2 = vaddq_f32(vaddq_f32(vmulq_f32(dx, dx),
+		                                     vmulq_f32(dy, dy)),
+		                           vmulq_f32(dz, dz));
+		float32x4_t along = vaddq_f32(vaddq_f32(vmulq_f32(dx, ux),
+		                                        vmulq_f32(dy, uy)),
+		                              vmulq_f32(dz, uz));
+		float32x4_t d = vsubq_f32(l2, vmulq_f32(along, along));
+		vst1q_f32(d2 + i, d);
+		uint32x4_t lt = vcltq_f32(d, t);
+		mask |= ((vgetq_lane_u32(lt, 0) & 1u) |
+		         (vgetq_lane_u32(lt, 1) & 2u) |
+		         (vgetq_lane_u32(lt, 2) & 4u) |
+		         (vgetq_lane_u32(lt, 3) & 8u)) << i;
+	}
+#else
+	for (int i = 0; i < MAX_PTS_PER_NODE; i++) {
+		float xp0 = x[i] - p[0], xp1 = y[i] - p[1],
+		      xp2 = z[i] - p[2];
+		d2[i] = sqr(xp0) + sqr(xp1) + sqr(xp2) -
+		        sqr(xp0 * dir[0] + xp1 * dir[1] + xp2 * dir[2]);
+		if (d2[i] < thresh2)
+			mask |= 1u << i;
+	}
+#endif
+	return mask & ((1u << npts) - 1);
+}
+
+
 // Create a KD tree from the points pointed to by the array pts
 void KDtree::Node::build(KDtree *kd, const float **pts, size_t n)
 {
@@ -152,6 +421,15 @@ void KDtree::Node::build(KDtree *kd, const float **pts, size_t n)
 	if (n <= MAX_PTS_PER_NODE) {
 		npts = n;
 		memcpy(leaf.p, pts, n * sizeof(float *));
+		coords = unsigned(kd->leaf_coords.size() / COORDS_PER_LEAF);
+		kd->leaf_coords.resize(kd->leaf_coords.size() + COORDS_PER_LEAF);
+		float *x = &kd->leaf_coords[size_t(coords) * COORDS_PER_LEAF];
+		float *y = x + MAX_PTS_PER_NODE, *z = y + MAX_PTS_PER_NODE;
+		for (size_t i = 0; i < n; i++) {
+			x[i] = pts[i][0];
+			y[i] = pts[i][1];
+			z[i] = pts[i][2];
+		}
 		return;
 	}
 
@@ -261,10 +539,18 @@ crossed:
 // Crawl the KD tree
 void KDtree::Node::find_closest_to_pt(KDtree::Node::Traversal_Info &ti) const
 {
+	KDTREE_COUNT(ti, nodes_visited, 1);
+
 	// Leaf nodes
 	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2(leaf.p[i], ti.p);
+		KDTREE_COUNT(ti, leaves_visited, 1);
+		KDTREE_COUNT(ti, points_tested, npts);
+		float d2[MAX_PTS_PER_NODE];
+		unsigned closer = leaf_closer_to_pt(ti, ti.closest_d2, d2);
+		for (int i = 0; closer; i++, closer >>= 1) {
+			if (!(closer & 1u))
+				continue;
+			float myd2 = d2[i];
 			if (myd2 < ti.closest_d2 && leaf.p[i] != ti.p) {
 				// The way this works is that closest_d2 is
 				// used once we get into the leaves, while
@@ -285,8 +571,10 @@ void KDtree::Node::find_closest_to_pt(KDtree::Node::Traversal_Info &ti) const
 
 
 	// Check whether to abort
-	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d))
+	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d)) {
+		KDTREE_COUNT(ti, nodes_pruned, 1);
 		return;
+	}
 
 	// Recursive case - pick the optimal order
 	float myd = node.center[node.splitaxis] - ti.p[node.splitaxis];
@@ -306,9 +594,16 @@ void KDtree::Node::find_closest_to_pt(KDtree::Node::Traversal_Info &ti) const
 // one function with the above, but it's more efficient to have 2 functions.
 void KDtree::Node::find_closest_compat_to_pt(KDtree::Node::Traversal_Info &ti) const
 {
+	KDTREE_COUNT(ti, nodes_visited, 1);
 	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2(leaf.p[i], ti.p);
+		KDTREE_COUNT(ti, leaves_visited, 1);
+		KDTREE_COUNT(ti, points_tested, npts);
+		float d2[MAX_PTS_PER_NODE];
+		unsigned closer = leaf_closer_to_pt(ti, ti.closest_d2, d2);
+		for (int i = 0; closer; i++, closer >>= 1) {
+			if (!(closer & 1u))
+				continue;
+			float myd2 = d2[i];
 			if (myd2 < ti.closest_d2 &&
 			    leaf.p[i] != ti.p &&
 			    (*ti.iscompat)(leaf.p[i])) {
@@ -321,8 +616,10 @@ void KDtree::Node::find_closest_compat_to_pt(KDtree::Node::Traversal_Info &ti) c
 		return;
 	}
 
-	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d))
+	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d)) {
+		KDTREE_COUNT(ti, nodes_pruned, 1);
 		return;
+	}
 
 	float myd = node.center[node.splitaxis] - ti.p[node.splitaxis];
 	if (myd >= 0.0f) {
@@ -341,10 +638,18 @@ void KDtree::Node::find_closest_compat_to_pt(KDtree::Node::Traversal_Info &ti) c
 // the line going through ti.p in the direction ti.dir
 void KDtree::Node::find_closest_to_ray(KDtree::Node::Traversal_Info &ti) const
 {
+	KDTREE_COUNT(ti, nodes_visited, 1);
+
 	// Leaf nodes
 	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2ray2(leaf.p[i], ti.p, ti.dir);
+		KDTREE_COUNT(ti, leaves_visited, 1);
+		KDTREE_COUNT(ti, points_tested, npts);
+		float d2[MAX_PTS_PER_NODE];
+		unsigned closer = leaf_closer_to_ray(ti, ti.closest_d2, d2);
+		for (int i = 0; closer; i++, closer >>= 1) {
+			if (!(closer & 1u))
+				continue;
+			float myd2 = d2[i];
 			if (myd2 < ti.closest_d2 && leaf.p[i] != ti.p) {
 				ti.closest_d2 = myd2;
 				// See earlier comment for how approx works
@@ -358,8 +663,11 @@ void KDtree::Node::find_closest_to_ray(KDtree::Node::Traversal_Info &ti) const
 
 
 	// Check whether to abort
-	if (dist2ray2(node.center, ti.p, ti.dir) >= sqr(node.r + ti.closest_d))
+	if (dist2ray2(node.center, ti.p, ti.dir) >=
+	    sqr(node.r + ti.closest_d)) {
+		KDTREE_COUNT(ti, nodes_pruned, 1);
 		return;
+	}
 
 	// Recursive case - pick the optimal order
 	if (ti.p[node.splitaxis] < node.center[node.splitaxis] ) {
@@ -375,9 +683,16 @@ void KDtree::Node::find_closest_to_ray(KDtree::Node::Traversal_Info &ti) const
 // Same as above, with compat
 void KDtree::Node::find_closest_compat_to_ray(KDtree::Node::Traversal_Info &ti) const
 {
+	KDTREE_COUNT(ti, nodes_visited, 1);
 	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2ray2(leaf.p[i], ti.p, ti.dir);
+		KDTREE_COUNT(ti, leaves_visited, 1);
+		KDTREE_COUNT(ti, points_tested, npts);
+		float d2[MAX_PTS_PER_NODE];
+		unsigned closer = leaf_closer_to_ray(ti, ti.closest_d2, d2);
+		for (int i = 0; closer; i++, closer >>= 1) {
+			if (!(closer & 1u))
+				continue;
+			float myd2 = d2[i];
 			if (myd2 < ti.closest_d2 &&
 			    leaf.p[i] != ti.p &&
 			    (*ti.iscompat)(leaf.p[i])) {
@@ -391,8 +706,11 @@ void KDtree::Node::find_closest_compat_to_ray(KDtree::Node::Traversal_Info &ti)
 		return;
 	}
 
-	if (dist2ray2(node.center, ti.p, ti.dir) >= sqr(node.r + ti.closest_d))
+	if (dist2ray2(node.center, ti.p, ti.dir) >=
+	    sqr(node.r + ti.closest_d)) {
+		KDTREE_COUNT(ti, nodes_pruned, 1);
 		return;
+	}
 
 	if (ti.p[node.splitaxis] < node.center[node.splitaxis] ) {
 		node.child1->find_closest_compat_to_ray(ti);
@@ -407,10 +725,19 @@ void KDtree::Node::find_closest_compat_to_ray(KDtree::Node::Traversal_Info &ti)
 // Crawl the KD tree, retaining k closest points
 void KDtree::Node::find_k_closest_to_pt(KDtree::Node::Traversal_Info &ti) const
 {
+	KDTREE_COUNT(ti, nodes_visited, 1);
+
 	// Leaf nodes
 	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2(leaf.p[i], ti.p);
+		KDTREE_COUNT(ti, leaves_visited, 1);
+		KDTREE_COUNT(ti, points_tested, npts);
+		float d2[MAX_PTS_PER_NODE];
+		unsigned closer = leaf_closer_to_pt(ti,
+			(ti.knn.size() < ti.k) ? HUGE_VALF : ti.closest_d2, d2);
+		for (int i = 0; closer; i++, closer >>= 1) {
+			if (!(closer & 1u))
+				continue;
+			float myd2 = d2[i];
 			if ((myd2 < ti.closest_d2 || ti.knn.size() < ti.k) &&
 			    leaf.p[i] != ti.p) {
 				float myd = sqrt(myd2);
@@ -433,8 +760,10 @@ void KDtree::Node::find_k_closest_to_pt(KDtree::Node::Traversal_Info &ti) const
 
 	// Check whether to abort
 	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d) &&
-	    ti.knn.size() == ti.k)
+	    ti.knn.size() == ti.k) {
+		KDTREE_COUNT(ti, nodes_pruned, 1);
 		return;
+	}
 
 	// Recursive case - pick the optimal order
 	float myd = node.center[node.splitaxis] - ti.p[node.splitaxis];
@@ -453,9 +782,17 @@ void KDtree::Node::find_k_closest_to_pt(KDtree::Node::Traversal_Info &ti) const
 // Same as above, with compat
 void KDtree::Node::find_k_closest_compat_to_pt(KDtree::Node::Traversal_Info &ti) const
 {
+	KDTREE_COUNT(ti, nodes_visited, 1);
 	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2(leaf.p[i], ti.p);
+		KDTREE_COUNT(ti, leaves_visited, 1);
+		KDTREE_COUNT(ti, points_tested, npts);
+		float d2[MAX_PTS_PER_NODE];
+		unsigned closer = leaf_closer_to_pt(ti,
+			(ti.knn.size() < ti.k) ? HUGE_VALF : ti.closest_d2, d2);
+		for (int i = 0; closer; i++, closer >>= 1) {
+			if (!(closer & 1u))
+				continue;
+			float myd2 = d2[i];
 			if ((myd2 < ti.closest_d2 || ti.knn.size() < ti.k) &&
 			    leaf.p[i] != ti.p &&
 			    (*ti.iscompat)(leaf.p[i])) {
@@ -475,8 +812,10 @@ void KDtree::Node::find_k_closest_compat_to_pt(KDtree::Node::Traversal_Info &ti)
 	}
 
 	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d) &&
-	    ti.knn.size() == ti.k)
+	    ti.knn.size() == ti.k) {
+		KDTREE_COUNT(ti, nodes_pruned, 1);
 		return;
+	}
 
 	float myd = node.center[node.splitaxis] - ti.p[node.splitaxis];
 	if (myd >= 0.0f) {
@@ -494,11 +833,16 @@ void KDtree::Node::find_k_closest_compat_to_pt(KDtree::Node::Traversal_Info &ti)
 // Crawl the KD tree to see whether a point exists within a distance of query
 bool KDtree::Node::exists_pt(KDtree::Node::Traversal_Info &ti) const
 {
+	KDTREE_COUNT(ti, nodes_visited, 1);
+
 	// Leaf nodes
 	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2(leaf.p[i], ti.p);
-			if (myd2 < ti.closest_d2 && leaf.p[i] != ti.p)
+		KDTREE_COUNT(ti, leaves_visited, 1);
+		KDTREE_COUNT(ti, points_tested, npts);
+		float d2[MAX_PTS_PER_NODE];
+		unsigned closer = leaf_closer_to_pt(ti, ti.closest_d2, d2);
+		for (int i = 0; closer; i++, closer >>= 1) {
+			if ((closer & 1u) && leaf.p[i] != ti.p)
 				return true;
 		}
 		return false;
@@ -506,8 +850,10 @@ bool KDtree::Node::exists_pt(KDtree::Node::Traversal_Info &ti) const
 
 
 	// Check whether to abort
-	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d))
+	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d)) {
+		KDTREE_COUNT(ti, nodes_pruned, 1);
 		return false;
+	}
 
 	// Recursive case - pick the optimal order
 	float myd = node.center[node.splitaxis] - ti.p[node.splitaxis];
@@ -523,6 +869,176 @@ bool KDtree::Node::exists_pt(KDtree::Node::Traversal_Info &ti) const
 }
 
 
+// Helpers for the best-bin-first searches below: update the closest
+// point(s) with the contents of a leaf
+inline void KDtree::Node::scan_leaf_closest(KDtree::Node::Traversal_Info &ti) const
+{
+	ti.stats.points_tested += npts;
+	float d2[MAX_PTS_PER_NODE];
+	unsigned closer = leaf_closer_to_pt(ti, ti.closest_d2, d2);
+	for (int i = 0; closer; i++, closer >>= 1) {
+		if (!(closer & 1u))
+			continue;
+		if (d2[i] < ti.closest_d2 &&
+		    leaf.p[i] != ti.p &&
+		    (!ti.iscompat || (*ti.iscompat)(leaf.p[i]))) {
+			ti.closest_d2 = d2[i];
+			ti.closest_d = sqrt(ti.closest_d2);
+			ti.closest = leaf.p[i];
+		}
+	}
+}
+
+inline void KDtree::Node::scan_leaf_k_closest(KDtree::Node::Traversal_Info &ti) const
+{
+	ti.stats.points_tested += npts;
+	float d2[MAX_PTS_PER_NODE];
+	unsigned closer = leaf_closer_to_pt(ti,
+		(ti.knn.size() < ti.k) ? HUGE_VALF : ti.closest_d2, d2);
+	for (int i = 0; closer; i++, closer >>= 1) {
+		if (!(closer & 1u))
+			continue;
+		if ((d2[i] < ti.closest_d2 || ti.knn.size() < ti.k) &&
+		    leaf.p[i] != ti.p &&
+		    (!ti.iscompat || (*ti.iscompat)(leaf.p[i]))) {
+			ti.knn.push_back(make_pair(sqrt(d2[i]), leaf.p[i]));
+			push_heap(ti.knn.begin(), ti.knn.end());
+			if (ti.knn.size() > ti.k) {
+				pop_heap(ti.knn.begin(), ti.knn.end());
+				ti.knn.pop_back();
+			}
+			ti.closest_d = ti.knn[0].first;
+			ti.closest_d2 = sqr(ti.knn[0].first);
+		}
+	}
+}
+
+
+// Best-bin-first search for the closest point: repeatedly take the
+// unexplored node with the smallest lower bound, walk down from it to a
+// leaf (queueing the far side at each split), and scan the leaf.
+// Stops when nothing in the queue can beat the current best, or after
+// ti.max_leaves leaves.
+void KDtree::Node::find_closest_to_pt_bbf(KDtree::Node::Traversal_Info &ti) const
+{
+	vector<node_with_d> queue;
+	queue.reserve(64);
+	queue.push_back(make_pair(0.0f, this));
+	while (!queue.empty()) {
+		pop_heap(queue.begin(), queue.end(), greater<node_with_d>());
+		float bound = queue.back().first;
+		const Node *n = queue.back().second;
+		queue.pop_back();
+		if (bound >= ti.closest_d)
+			break;
+
+		while (n && !n->npts) {
+			ti.stats.nodes_visited++;
+			if (dist2(n->node.center, ti.p) >=
+			    sqr(n->node.r + ti.closest_d)) {
+				ti.stats.nodes_pruned++;
+				n = NULL;
+				break;
+			}
+			float myd = n->node.center[n->node.splitaxis] -
+			            ti.p[n->node.splitaxis];
+			const Node *nearer = n->node.child1, *farther = n->node.child2;
+			if (myd < 0.0f) {
+				swap(nearer, farther);
+				myd = -myd;
+			}
+			float farbound = max(bound, myd);
+			if (farbound < ti.closest_d) {
+				queue.push_back(make_pair(farbound, farther));
+				push_heap(queue.begin(), queue.end(),
+				          greater<node_with_d>());
+			} else {
+				ti.stats.nodes_pruned++;
+			}
+			n = nearer;
+		}
+		if (!n)
+			continue;
+
+		ti.stats.nodes_visited++;
+		ti.stats.leaves_visited++;
+		n->scan_leaf_closest(ti);
+		if (ti.stats.leaves_visited >= ti.max_leaves)
+			break;
+	}
+}
+
+
+// Same as above, retaining the k closest points
+void KDtree::Node::find_k_closest_to_pt_bbf(KDtree::Node::Traversal_Info &ti) const
+{
+	vector<node_with_d> queue;
+	queue.reserve(64);
+	queue.push_back(make_pair(0.0f, this));
+	while (!queue.empty()) {
+		pop_heap(queue.begin(), queue.end(), greater<node_with_d>());
+		float bound = queue.back().first;
+		const Node *n = queue.back().second;
+		queue.pop_back();
+		if (bound >= ti.closest_d && ti.knn.size() == ti.k)
+			break;
+
+		while (n && !n->npts) {
+			ti.stats.nodes_visited++;
+			if (dist2(n->node.center, ti.p) >=
+			    sqr(n->node.r + ti.closest_d) &&
+			    ti.knn.size() == ti.k) {
+				ti.stats.nodes_pruned++;
+				n = NULL;
+				break;
+			}
+			float myd = n->node.center[n->node.splitaxis] -
+			            ti.p[n->node.splitaxis];
+			const Node *nearer = n->node.child1, *farther = n->node.child2;
+			if (myd < 0.0f) {
+				swap(nearer, farther);
+				myd = -myd;
+			}
+			float farbound = max(bound, myd);
+			if (farbound < ti.closest_d || ti.knn.size() != ti.k) {
+				queue.push_back(make_pair(farbound, farther));
+				push_heap(queue.begin(), queue.end(),
+				          greater<node_with_d>());
+			} else {
+				ti.stats.nodes_pruned++;
+			}
+			n = nearer;
+		}
+		if (!n)
+			continue;
+
+		ti.stats.nodes_visited++;
+		ti.stats.leaves_visited++;
+		n->scan_leaf_k_closest(ti);
+		if (ti.stats.leaves_visited >= ti.max_leaves)
+			break;
+	}
+}
+
+
+// Accumulate statistics about the shape of the subtree rooted here
+void KDtree::Node::collect_stats(KDtree::Stats &s, size_t depth) const
+{
+	s.nnodes++;
+	if (depth > s.max_depth)
+		s.max_depth = depth;
+	if (npts) {
+		s.npts += npts;
+		s.nleaves++;
+		s.leaf_occupancy[npts]++;
+		s.mean_leaf_depth += depth;
+		return;
+	}
+	node.child1->collect_stats(s, depth + 1);
+	node.child2->collect_stats(s, depth + 1);
+}
+
+
 // Create a KDtree from a list of points (i.e., ptlist is a list of 3*n floats)
 void KDtree::build(const float *ptlist, size_t n)
 {
@@ -546,6 +1062,9 @@ void KDtree::build(const float **pts, size_t n)
 	storage = new NodeStorageBlock;
 	root = Node::alloc(this);
 	root->build(this, pts, n);
+#ifdef KDTREE_STATS
+	counters = new Counters;
+#endif
 }
 
 
@@ -556,6 +1075,8 @@ KDtree::~KDtree()
 		delete storage;
 	storage = NULL;
 	root = NULL;
+	delete counters;
+	counters = NULL;
 }
 
 
@@ -570,6 +1091,7 @@ const float *KDtree::closest_to_pt(const float *p,
 
 	Node::Traversal_Info ti;
 	ti.p = p;
+	ti.leaf_coords = leaf_coords.data();
 	ti.iscompat = iscompat;
 	ti.closest = NULL;
 	if (maxdist2 <= 0.0f)
@@ -582,6 +1104,7 @@ const float *KDtree::closest_to_pt(const float *p,
 		root->find_closest_compat_to_pt(ti);
 	else
 		root->find_closest_to_pt(ti);
+	KDTREE_RECORD(ti);
 
 	return ti.closest;
 }
@@ -604,6 +1127,7 @@ const float *KDtree::closest_to_ray(const float *p, const float *dir,
 	Node::Traversal_Info ti;
 	ti.dir = normalized_dir;
 	ti.p = p;
+	ti.leaf_coords = leaf_coords.data();
 	ti.iscompat = iscompat;
 	ti.closest = NULL;
 	if (maxdist2 <= 0.0f)
@@ -616,6 +1140,7 @@ const float *KDtree::closest_to_ray(const float *p, const float *dir,
 		root->find_closest_compat_to_ray(ti);
 	else
 		root->find_closest_to_ray(ti);
+	KDTREE_RECORD(ti);
 
 	return ti.closest;
 }
@@ -635,6 +1160,7 @@ void KDtree::find_k_closest_to_pt(std::vector<const float *> &knn,
 
 	Node::Traversal_Info ti;
 	ti.p = p;
+	ti.leaf_coords = leaf_coords.data();
 	ti.iscompat = iscompat;
 	ti.closest = NULL;
 	if (maxdist2 <= 0.0f)
@@ -649,6 +1175,132 @@ void KDtree::find_k_closest_to_pt(std::vector<const float *> &knn,
 		root->find_k_closest_compat_to_pt(ti);
 	else
 		root->find_k_closest_to_pt(ti);
+	KDTREE_RECORD(ti);
+
+	size_t found = ti.knn.size();
+	if (!found)
+		return;
+
+	knn.resize(found);
+	sort_heap(ti.knn.begin(), ti.knn.end());
+	for (size_t i = 0; i < found; i++)
+		knn[i] = ti.knn[i].second;
+}
+
+
+// Find the k nearest neighbors of many points
+void KDtree::find_k_closest_to_pts(std::vector<const float *> &knn,
+                                   int k,
+                                   const float *pts,
+                                   size_t n,
+                                   float maxdist2 /* = 0.0f */,
+                                   float approx_eps /* = 0.0f */) const
+{
+	knn.clear();
+	if (k <= 0)
+		return;
+	knn.resize(size_t(k) * n, NULL);
+	if (!root || !pts)
+		return;
+
+	if (maxdist2 <= 0.0f)
+		maxdist2 = sqr(root->node.r);
+	ptrdiff_t nq = n;
+#pragma omp parallel
+	{
+		Node::Traversal_Info ti;
+		ti.leaf_coords = leaf_coords.data();
+		ti.iscompat = NULL;
+		ti.knn.reserve(k+1);
+		ti.k = k;
+		ti.approx_multiplier = 1.0f / (1.0f + approx_eps);
+#pragma omp for schedule(dynamic,256)
+		for (ptrdiff_t i = 0; i < nq; i++) {
+			ti.p = pts + 3 * i;
+			ti.closest = NULL;
+			ti.closest_d2 = maxdist2;
+			ti.closest_d = sqrt(ti.closest_d2);
+			ti.knn.clear();
+			ti.stats = QueryStats();
+			root->find_k_closest_to_pt(ti);
+			KDTREE_RECORD(ti);
+
+			sort_heap(ti.knn.begin(), ti.knn.end());
+			size_t found = ti.knn.size();
+			for (size_t j = 0; j < found; j++)
+				knn[size_t(k) * i + j] = ti.knn[j].second;
+		}
+	}
+}
+
+
+// Bounded-work approximate closest point
+const float *KDtree::closest_to_pt_bbf(const float *p,
+                                       size_t max_leaves,
+                                       float maxdist2 /* = 0.0f */,
+                                       const CompatFunc *iscompat /* = NULL */,
+                                       QueryStats *stats /* = NULL */) const
+{
+	if (stats)
+		*stats = QueryStats();
+	if (!root || !p)
+		return NULL;
+
+	Node::Traversal_Info ti;
+	ti.p = p;
+	ti.leaf_coords = leaf_coords.data();
+	ti.iscompat = iscompat;
+	ti.closest = NULL;
+	if (maxdist2 <= 0.0f)
+		maxdist2 = sqr(root->node.r);
+	ti.closest_d2 = maxdist2;
+	ti.closest_d = sqrt(ti.closest_d2);
+	ti.approx_multiplier = 1.0f;
+	ti.max_leaves = max(max_leaves, size_t(1));
+
+	root->find_closest_to_pt_bbf(ti);
+	KDTREE_RECORD(ti);
+
+	if (stats)
+		*stats = ti.stats;
+	return ti.closest;
+}
+
+
+// Bounded-work approximate k nearest neighbors
+void KDtree::find_k_closest_to_pt_bbf(std::vector<const float *> &knn,
+                                      int k,
+                                      const float *p,
+                                      size_t max_leaves,
+                                      float maxdist2 /* = 0.0f */,
+                                      const CompatFunc *iscompat /* = NULL */,
+                                      QueryStats *stats /* = NULL */) const
+{
+	knn.clear();
+	if (stats)
+		*stats = QueryStats();
+	if (!root || !p)
+		return;
+
+	Node::Traversal_Info ti;
+	ti.p = p;
+	ti.leaf_coords = leaf_coords.data();
+	ti.iscompat = iscompat;
+	ti.closest = NULL;
+	if (maxdist2 <= 0.0f)
+		maxdist2 = sqr(root->node.r);
+	ti.closest_d2 = maxdist2;
+	ti.closest_d = sqrt(ti.closest_d2);
+	ti.knn.reserve(k+1);
+	ti.k = k;
+	ti.approx_multiplier = 1.0f;
+	ti.max_leaves = max(max_leaves, size_t(1));
+
+	root->find_k_closest_to_pt_bbf(ti);
+	KDTREE_RECORD(ti);
+
+	if (stats)
+		*stats = ti.stats;
 
 	size_t found = ti.knn.size();
 	if (!found)
@@ -669,11 +1321,48 @@ bool KDtree::exists_pt_within(const float *p, float maxdist) const
 
 	Node::Traversal_Info ti;
 	ti.p = p;
+	ti.leaf_coords = leaf_coords.data();
 	ti.closest = NULL;
 	ti.closest_d = maxdist;
 	ti.closest_d2 = sqr(maxdist);
 
-	return root->exists_pt(ti);
+	bool found = root->exists_pt(ti);
+	KDTREE_RECORD(ti);
+	return found;
+}
+
+
+// Statistics about the tree and the queries made on it so far
+KDtree::Stats KDtree::stats() const
+{
+	Stats s;
+	s.npts = s.nnodes = s.nleaves = s.max_depth = 0;
+	s.mean_leaf_depth = 0.0f;
+	s.leaf_occupancy.resize(Node::MAX_PTS_PER_NODE + 1);
+	s.queries = 0;
+
+	if (root) {
+		root->collect_stats(s, 0);
+		s.mean_leaf_depth /= s.nleaves;
+	}
+	if (counters) {
+		size_t t[Counters::NCOUNTERS];
+		counters->totals(t);
+		s.queries = t[Counters::QUERIES];
+		s.work.nodes_visited = t[Counters::NODES_VISITED];
+		s.work.leaves_visited = t[Counters::LEAVES_VISITED];
+		s.work.points_tested = t[Counters::POINTS_TESTED];
+		s.work.nodes_pruned = t[Counters::NODES_PRUNED];
+	}
+	return s;
+}
+
+
+// Reset the query counters
+void KDtree::reset_stats()
+{
+	if (counters)
+		counters->reset();
 }
 
 } // namespace trimesh
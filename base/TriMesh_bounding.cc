@@ -69,7 +69,7 @@ void TriMesh::need_bsphere()
 static int farthest_vertex_along(const TriMesh &t, const vec &dir)
 {
 	const vector<point> &v = t.vertices;
-	int nv = v.size();
+	ptrdiff_t nv = v.size();
 
 	int farthest = 0;
 	float farthest_dot = v[0] DOT dir;
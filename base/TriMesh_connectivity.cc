@@ -8,12 +8,15 @@ Manipulate data structures that describe connectivity between faces and verts.
 
 
 #include "trimesh2/TriMesh.h"
+#include "trimesh2/VertexBlocks.h"
+#include <algorithm>
+#include <cstdint>
 using namespace std;
 
 
 namespace trimesh {
 
-// Find the direct neighbors of each vertex
+// Find the direct neighbors of each vertex.  Each list is sorted.
 void TriMesh::need_neighbors()
 {
 	if (!neighbors.empty())
@@ -24,36 +27,38 @@ void TriMesh::need_neighbors()
 		return;
 
 	dprintf("Finding vertex neighbors... ");
-	int nv = vertices.size(), nf = faces.size();
+	ptrdiff_t nv = vertices.size();
 
+	// Each face corner contributes two (possibly duplicate) neighbors,
+	// which come out sorted
+	Adjacency tmp;
+	bucket_by_vertex<int, 2>(faces, nv, tmp.offsets, tmp.indices,
+		[&](ptrdiff_t i, int j, int *v, int *n) -> int {
+			v[0] = v[1] = faces[i][j];
+			n[0] = faces[i][NEXT_MOD3(j)];
+			n[1] = faces[i][PREV_MOD3(j)];
+			return 2;
+		});
+
+	// Remove duplicates, then squeeze out the unused room
 	vector<int> numneighbors(nv);
-	for (int i = 0; i < nf; i++) {
-		numneighbors[faces[i][0]]++;
-		numneighbors[faces[i][1]]++;
-		numneighbors[faces[i][2]]++;
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nv; i++) {
+		Adjacency::range r = tmp[i];
+		numneighbors[i] = unique(r.begin(), r.end()) - r.begin();
 	}
 
-	neighbors.resize(nv);
-	for (int i = 0; i < nv; i++)
-		neighbors[i].reserve(numneighbors[i]);
-
-	for (int i = 0; i < nf; i++) {
-		for (int j = 0; j < 3; j++) {
-			vector<int> &me = neighbors[faces[i][j]];
-			int n1 = faces[i][NEXT_MOD3(j)];
-			int n2 = faces[i][PREV_MOD3(j)];
-			if (find(me.begin(), me.end(), n1) == me.end())
-				me.push_back(n1);
-			if (find(me.begin(), me.end(), n2) == me.end())
-				me.push_back(n2);
-		}
-	}
+	neighbors.set_sizes(numneighbors);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nv; i++)
+		copy(tmp[i].begin(), tmp[i].begin() + numneighbors[i],
+		     neighbors[i].begin());
 
 	dprintf("Done.\n");
 }
 
 
-// Find the faces touching each vertex
+// Find the faces touching each vertex.  Each list is sorted.
 void TriMesh::need_adjacentfaces()
 {
 	if (!adjacentfaces.empty())
@@ -64,65 +69,701 @@ void TriMesh::need_adjacentfaces()
 		return;
 
 	dprintf("Finding vertex to triangle maps... ");
-	int nv = vertices.size(), nf = faces.size();
+	ptrdiff_t nv = vertices.size();
+
+	bucket_by_vertex<int, 1>(faces, nv, adjacentfaces.offsets,
+		adjacentfaces.indices,
+		[&](ptrdiff_t i, int j, int *v, int *f) -> int {
+			v[0] = faces[i][j];
+			f[0] = int(i);
+			return 1;
+		});
+
+	dprintf("Done.\n");
+}
+
+
+// Half-edges are numbered 3 * face + corner, which takes more than 32
+// bits for big meshes.  The entries made by sort_half_edges have the
+// higher-numbered vertex of the edge above the half-edge number, which
+// gets only as many bits as the mesh needs, so both always fit.
+struct HalfEdgeKeys {
+	int shift;
+	HalfEdgeKeys(ptrdiff_t nf) : shift(0)
+	{
+		while ((uint64_t(1) << shift) < uint64_t(3 * nf))
+			shift++;
+	}
+	uint64_t make(int other, uint64_t he) const
+		{ return (uint64_t(other) << shift) | he; }
+	int other(uint64_t entry) const
+		{ return int(entry >> shift); }
+	uint64_t he(uint64_t entry) const
+		{ return entry & ((uint64_t(1) << shift) - 1); }
+};
+
+
+// Does half-edge he go from the lower-numbered vertex to the higher one?
+static inline bool he_up(const vector<TriMesh::Face> &faces, uint64_t he)
+{
+	const TriMesh::Face &f = faces[he / 3];
+	int j = he % 3;
+	return f[NEXT_MOD3(j)] < f[PREV_MOD3(j)];
+}
+
+
+// Sort the half-edges so that the ones belonging to the same edge are
+// together.  This is a radix sort with the lower-numbered vertex of each
+// edge as the (single) digit: the half-edges are bucketed by that vertex,
+// then each (small) bucket is sorted by the other vertex.  Degenerate
+// edges (with the same vertex at both ends) are skipped.
+//
+// Bucket v is entries[offsets[v]] through entries[offsets[v+1]-1].  Each
+// entry is keys.make(higher-numbered vertex, half-edge number).  Sorting
+// the entries sorts by vertex, then by face.
+static void sort_half_edges(const vector<TriMesh::Face> &faces, ptrdiff_t nv,
+                            const HalfEdgeKeys &keys,
+                            vector<size_t> &offsets,
+                            vector<uint64_t> &entries)
+{
+	bucket_by_vertex<uint64_t, 1>(faces, nv, offsets, entries,
+		[&](ptrdiff_t i, int j, int *v, uint64_t *entry) -> int {
+			int v1 = faces[i][NEXT_MOD3(j)];
+			int v2 = faces[i][PREV_MOD3(j)];
+			if (v1 == v2)
+				return 0;
+			v[0] = min(v1, v2);
+			entry[0] = keys.make(max(v1, v2), 3 * uint64_t(i) + j);
+			return 1;
+		});
+}
+
 
-	vector<int> numadjacentfaces(nv);
-	for (int i = 0; i < nf; i++) {
-		numadjacentfaces[faces[i][0]]++;
-		numadjacentfaces[faces[i][1]]++;
-		numadjacentfaces[faces[i][2]]++;
+// Fill in across_edge for the n half-edges of one edge, given in order
+// as (half-edge number << 1) | he_up(half-edge).  A half-edge is matched
+// with the first half-edge of the same edge that goes in the opposite
+// direction, on a different face.
+static void match_half_edges(const uint64_t *run, size_t n,
+                             vector<TriMesh::Face> &across_edge)
+{
+	for (size_t k = 0; k < n; k++) {
+		uint64_t he = run[k];
+		ptrdiff_t i = (he >> 1) / 3;
+		int j = (he >> 1) % 3;
+		across_edge[i][j] = -1;
+		for (size_t k2 = 0; k2 < n; k2++) {
+			uint64_t he2 = run[k2];
+			int i2 = int((he2 >> 1) / 3);
+			if (i2 == i || !((he ^ he2) & 1u))
+				continue;
+			across_edge[i][j] = i2;
+			break;
+		}
 	}
+}
+
+
+// Fill in across_edge, optionally listing the bad edges
+static void build_across_edge(const vector<TriMesh::Face> &faces, ptrdiff_t nv,
+                              vector<TriMesh::Face> &across_edge,
+                              vector<TriMesh::Edge> *nonmanifold,
+                              vector<TriMesh::Edge> *misoriented)
+{
+	ptrdiff_t nf = faces.size();
+	across_edge.clear();
+	across_edge.resize(nf, TriMesh::Face(-1,-1,-1));
 
-	adjacentfaces.resize(vertices.size());
-	for (int i = 0; i < nv; i++)
-		adjacentfaces[i].reserve(numadjacentfaces[i]);
+	HalfEdgeKeys keys(nf);
+	vector<size_t> offsets;
+	vector<uint64_t> entries;
+	sort_half_edges(faces, nv, keys, offsets, entries);
+
+	// Match up the half-edges of each edge.  The first entry of each
+	// bad edge gets flagged.
+	enum { EDGE_OK, EDGE_NONMANIFOLD, EDGE_MISORIENTED };
+	vector<unsigned char> bad;
+	if (nonmanifold || misoriented)
+		bad.resize(entries.size(), EDGE_OK);
+
+#pragma omp parallel for schedule(dynamic,1024)
+	for (ptrdiff_t v = 0; v < nv; v++) {
+		const uint64_t *bucket = entries.data() + offsets[v];
+		size_t n = offsets[v+1] - offsets[v];
+		size_t run_end;
+		vector<uint64_t> hes;
+		for (size_t run = 0; run < n; run = run_end) {
+			int other = keys.other(bucket[run]);
+			run_end = run + 1;
+			while (run_end < n && keys.other(bucket[run_end]) == other)
+				run_end++;
+
+			// Boundary edges are left at -1
+			size_t nhalf = run_end - run;
+			if (nhalf == 1)
+				continue;
+
+			// Common case: a manifold edge
+			bool misoriented = false;
+			if (nhalf == 2) {
+				uint64_t he1 = keys.he(bucket[run]);
+				uint64_t he2 = keys.he(bucket[run+1]);
+				int i1 = int(he1 / 3), j1 = he1 % 3;
+				int i2 = int(he2 / 3), j2 = he2 % 3;
+				misoriented = he_up(faces, he1) == he_up(faces, he2);
+				if (!misoriented && i1 != i2) {
+					across_edge[i1][j1] = i2;
+					across_edge[i2][j2] = i1;
+					continue;
+				}
+			}
 
-	for (int i = 0; i < nf; i++) {
-		for (int j = 0; j < 3; j++)
-			adjacentfaces[faces[i][j]].push_back(i);
+			hes.clear();
+			for (size_t k = run; k < run_end; k++) {
+				uint64_t he = keys.he(bucket[k]);
+				hes.push_back((he << 1) | uint64_t(he_up(faces, he)));
+			}
+			match_half_edges(hes.data(), nhalf, across_edge);
+
+			if (bad.empty())
+				continue;
+			if (nhalf > 2)
+				bad[offsets[v] + run] = EDGE_NONMANIFOLD;
+			else if (misoriented)
+				bad[offsets[v] + run] = EDGE_MISORIENTED;
+		}
 	}
 
-	dprintf("Done.\n");
+	if (bad.empty())
+		return;
+
+	// Collect the bad edges, in order
+	if (nonmanifold)
+		nonmanifold->clear();
+	if (misoriented)
+		misoriented->clear();
+	for (ptrdiff_t v = 0; v < nv; v++) {
+		for (size_t k = offsets[v]; k < offsets[v+1]; k++) {
+			if (bad[k] == EDGE_OK)
+				continue;
+			TriMesh::Edge e(v, keys.other(entries[k]));
+			if (bad[k] == EDGE_NONMANIFOLD && nonmanifold)
+				nonmanifold->push_back(e);
+			else if (bad[k] == EDGE_MISORIENTED && misoriented)
+				misoriented->push_back(e);
+		}
+	}
 }
 
 
-// Find the face across each edge from each other face (-1 on boundary)
-// If topology is bad, not necessarily what one would expect...
+// Find the face across each edge from each other face (-1 on boundary).
+// Faces are only connected if they traverse the shared edge in opposite
+// directions.  If more than two faces share an edge, each one is connected
+// to the lowest-numbered face that is oriented consistently with it.
 void TriMesh::need_across_edge()
 {
 	if (!across_edge.empty())
 		return;
 
-	need_adjacentfaces();
-	if (adjacentfaces.empty())
+	need_faces();
+	if (faces.empty())
 		return;
 
 	dprintf("Finding across-edge maps... ");
+	build_across_edge(faces, vertices.size(), across_edge, NULL, NULL);
+	dprintf("Done.\n");
+}
+
+
+// Find the bad edges in the mesh: those shared by more than two faces,
+// and those shared by two faces that traverse them in the same direction.
+// Also builds across_edge, if it is not there already.
+void TriMesh::find_bad_edges(vector<Edge> &nonmanifold,
+                             vector<Edge> &misoriented)
+{
+	nonmanifold.clear();
+	misoriented.clear();
+	need_faces();
+	if (faces.empty())
+		return;
+
+	dprintf("Finding bad edges... ");
+	if (across_edge.empty()) {
+		build_across_edge(faces, vertices.size(), across_edge,
+		                  &nonmanifold, &misoriented);
+	} else {
+		vector<Face> tmp;
+		build_across_edge(faces, vertices.size(), tmp,
+		                  &nonmanifold, &misoriented);
+	}
+	dprintf("%lu non-manifold, %lu misoriented.\n",
+		(unsigned long) nonmanifold.size(),
+		(unsigned long) misoriented.size());
+}
+
+
+// Find the unique edges in the mesh, and the edges of each face
+void TriMesh::need_edges()
+{
+	if (!edges.empty())
+		return;
+
+	need_faces();
+	if (faces.empty())
+		return;
+
+	dprintf("Finding edges... ");
+	ptrdiff_t nv = vertices.size(), nf = faces.size();
+	HalfEdgeKeys keys(nf);
+	vector<size_t> offsets;
+	vector<uint64_t> entries;
+	sort_half_edges(faces, nv, keys, offsets, entries);
+
+	// Count the distinct edges starting at each vertex, and number them
+	vector<int> first(nv + 1);
+#pragma omp parallel for
+	for (ptrdiff_t v = 0; v < nv; v++) {
+		int n = 0;
+		for (size_t k = offsets[v]; k < offsets[v+1]; k++) {
+			if (k == offsets[v] ||
+			    keys.other(entries[k]) != keys.other(entries[k-1]))
+				n++;
+		}
+		first[v+1] = n;
+	}
+	for (ptrdiff_t v = 0; v < nv; v++)
+		first[v+1] += first[v];
+
+	edges.resize(first[nv]);
+	faceedges.clear();
+	faceedges.resize(nf, Face(-1,-1,-1));
+#pragma omp parallel for
+	for (ptrdiff_t v = 0; v < nv; v++) {
+		int e = first[v] - 1;
+		for (size_t k = offsets[v]; k < offsets[v+1]; k++) {
+			int other = keys.other(entries[k]);
+			if (k == offsets[v] ||
+			    other != keys.other(entries[k-1]))
+				edges[++e] = Edge(v, other);
+			uint64_t he = keys.he(entries[k]);
+			faceedges[he / 3][he % 3] = e;
+		}
+	}
+
+	dprintf("Done.\n");
+}
 
-	int nf = faces.size();
-	across_edge.resize(nf, Face(-1,-1,-1));
 
-//#pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
+// Find the boundary loops.  Each boundary half-edge (one with no face
+// across it) is linked to the next one by walking around the fan of faces
+// at its end vertex, which is done in parallel.  The loops are then just
+// the cycles of those links.
+void TriMesh::need_boundary_loops()
+{
+	if (!boundary_loops.empty())
+		return;
+
+	need_faces();
+	if (faces.empty())
+		return;
+	need_across_edge();
+
+	dprintf("Finding boundary loops... ");
+	ptrdiff_t nf = faces.size();
+
+	// The boundary half-edges, as 3 * face + corner, in order
+	vector<ptrdiff_t> bdy;
+	for (ptrdiff_t i = 0; i < nf; i++) {
 		for (int j = 0; j < 3; j++) {
-			int v1 = faces[i][NEXT_MOD3(j)];
-			int v2 = faces[i][PREV_MOD3(j)];
-			const vector<int> &a1 = adjacentfaces[v1];
-			for (size_t k1 = 0; k1 < a1.size(); k1++) {
-				int other = a1[k1];
-				if (other == i)
+			if (across_edge[i][j] < 0 &&
+			    faces[i][NEXT_MOD3(j)] != faces[i][PREV_MOD3(j)])
+				bdy.push_back(3 * i + j);
+		}
+	}
+	ptrdiff_t nb = bdy.size();
+
+	// For each one, find the following one: the first boundary half-edge
+	// out of its end vertex, turning towards the inside of the surface.
+	// At messy (non-manifold) spots, this can fail, leaving -1.
+	vector<ptrdiff_t> next(nb, -1);
+#pragma omp parallel for
+	for (ptrdiff_t k = 0; k < nb; k++) {
+		int f = int(bdy[k] / 3), c = PREV_MOD3(bdy[k] % 3);
+		int v = faces[f][c];
+		for (ptrdiff_t steps = 0; steps < nf; steps++) {
+			// The half-edge out of v in face f is opposite prev(c)
+			int out = PREV_MOD3(c);
+			int f2 = across_edge[f][out];
+			if (f2 < 0) {
+				ptrdiff_t he = 3 * ptrdiff_t(f) + out;
+				const ptrdiff_t *p =
+					lower_bound(&bdy[0], &bdy[0] + nb, he);
+				if (p != &bdy[0] + nb && *p == he)
+					next[k] = p - &bdy[0];
+				break;
+			}
+			// Cross to f2, which has the same edge going into v
+			int w = faces[f][NEXT_MOD3(c)], c2 = -1;
+			for (int j = 0; j < 3; j++) {
+				if (faces[f2][j] == v && faces[f2][PREV_MOD3(j)] == w) {
+					c2 = j;
+					break;
+				}
+			}
+			if (c2 < 0 || f2 == bdy[k] / 3)
+				break;
+			f = f2;
+			c = c2;
+		}
+	}
+
+	// Follow the links to find the loops.  A loop that passes through
+	// the same vertex twice (where two holes touch) is split in two.
+	vector<bool> used(nb);
+	vector<int> sizes, verts, loop, pos(vertices.size(), -1);
+	for (ptrdiff_t k = 0; k < nb; k++) {
+		if (used[k])
+			continue;
+		for (ptrdiff_t h = k; h >= 0 && !used[h]; h = next[h]) {
+			used[h] = true;
+			int v = faces[bdy[h] / 3][NEXT_MOD3(int(bdy[h] % 3))];
+			if (pos[v] >= 0) {
+				int p = pos[v];
+				sizes.push_back(loop.size() - p);
+				for (size_t i = p; i < loop.size(); i++) {
+					verts.push_back(loop[i]);
+					pos[loop[i]] = -1;
+				}
+				loop.resize(p);
+			}
+			pos[v] = loop.size();
+			loop.push_back(v);
+		}
+		sizes.push_back(loop.size());
+		for (size_t i = 0; i < loop.size(); i++) {
+			verts.push_back(loop[i]);
+			pos[loop[i]] = -1;
+		}
+		loop.clear();
+	}
+	boundary_loops.set_sizes(sizes);
+	boundary_loops.indices.swap(verts);
+
+	dprintf("%lu loops.\n", (unsigned long) sizes.size());
+}
+
+
+// Length of boundary loop i
+float TriMesh::boundary_loop_length(int i)
+{
+	need_boundary_loops();
+	Adjacency::const_range loop = boundary_loops[i];
+	size_t n = loop.size();
+	float l = 0.0f;
+	for (size_t k = 0; k < n; k++)
+		l += dist(vertices[loop[k]], vertices[loop[(k + 1) % n]]);
+	return l;
+}
+
+
+// Area of the polygon outlined by boundary loop i.  For a non-planar loop,
+// this is the area of its projection onto the plane in which it is largest.
+float TriMesh::boundary_loop_area(int i)
+{
+	need_boundary_loops();
+	Adjacency::const_range loop = boundary_loops[i];
+	size_t n = loop.size();
+	if (n < 3)
+		return 0.0f;
+	const point &p0 = vertices[loop[0]];
+	vec a;
+	for (size_t k = 1; k + 1 < n; k++)
+		a += (vertices[loop[k]] - p0) TRICROSS (vertices[loop[k+1]] - p0);
+	return 0.5f * len(a);
+}
+
+
+// Helpers for patch_connectivity.  "touched" lists the vertices of the
+// faces being removed, and slot[v] is v's position in that list (or -1).
+// Only the lists of touched vertices, and the edges between them, change.
+
+// Neighbors of touched vertices are recomputed from their surviving
+// adjacent faces.  Other vertices keep theirs.
+static void patch_neighbors(const vector<TriMesh::Face> &faces,
+                            const vector<int> &face_remap,
+                            const vector<int> &touched,
+                            const vector<int> &slot,
+                            const Adjacency &adjacentfaces,
+                            Adjacency &neighbors)
+{
+	ptrdiff_t nv = neighbors.size(), nt = touched.size();
+	vector< vector<int> > lists(nt);
+#pragma omp parallel for schedule(dynamic,64)
+	for (ptrdiff_t t = 0; t < nt; t++) {
+		int v = touched[t];
+		Adjacency::const_range a = adjacentfaces[v];
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (face_remap[f] < 0)
+				continue;
+			for (int j = 0; j < 3; j++) {
+				if (faces[f][j] != v)
 					continue;
-				int v2_in_other = faces[other].indexof(v2);
-				if (v2_in_other < 0)
+				lists[t].push_back(faces[f][NEXT_MOD3(j)]);
+				lists[t].push_back(faces[f][PREV_MOD3(j)]);
+			}
+		}
+		sort(lists[t].begin(), lists[t].end());
+		lists[t].erase(unique(lists[t].begin(), lists[t].end()),
+		               lists[t].end());
+	}
+
+	vector<int> sizes(nv);
+#pragma omp parallel for
+	for (ptrdiff_t v = 0; v < nv; v++)
+		sizes[v] = (slot[v] < 0) ? neighbors[v].size() :
+		                           lists[slot[v]].size();
+
+	Adjacency tmp;
+	tmp.set_sizes(sizes);
+#pragma omp parallel for
+	for (ptrdiff_t v = 0; v < nv; v++) {
+		if (slot[v] < 0)
+			copy(neighbors[v].begin(), neighbors[v].end(),
+			     tmp[v].begin());
+		else
+			copy(lists[slot[v]].begin(), lists[slot[v]].end(),
+			     tmp[v].begin());
+	}
+	neighbors.swap(tmp);
+}
+
+
+// Adjacent faces are renumbered, dropping the removed ones.  Since the
+// faces keep their order, the lists stay sorted.
+static void patch_adjacentfaces(const vector<int> &face_remap,
+                                const vector<int> &slot,
+                                Adjacency &adjacentfaces)
+{
+	ptrdiff_t nv = adjacentfaces.size();
+	vector<int> sizes(nv);
+#pragma omp parallel for
+	for (ptrdiff_t v = 0; v < nv; v++) {
+		Adjacency::const_range a = adjacentfaces[v];
+		if (slot[v] < 0) {
+			sizes[v] = a.size();
+			continue;
+		}
+		for (size_t k = 0; k < a.size(); k++)
+			if (face_remap[a[k]] >= 0)
+				sizes[v]++;
+	}
+
+	Adjacency tmp;
+	tmp.set_sizes(sizes);
+#pragma omp parallel for
+	for (ptrdiff_t v = 0; v < nv; v++) {
+		Adjacency::const_range a = adjacentfaces[v];
+		Adjacency::range t = tmp[v];
+		size_t n = 0;
+		for (size_t k = 0; k < a.size(); k++)
+			if (face_remap[a[k]] >= 0)
+				t[n++] = face_remap[a[k]];
+	}
+	adjacentfaces.swap(tmp);
+}
+
+
+// across_edge is renumbered, then the half-edges of each edge of a
+// removed face are matched up again.  Matches elsewhere can't change.
+static void patch_across_edge(const vector<TriMesh::Face> &faces,
+                              const vector<int> &face_remap,
+                              const vector<int> &removed,
+                              const vector<int> &slot,
+                              ptrdiff_t new_nf,
+                              vector<TriMesh::Face> &across_edge)
+{
+	ptrdiff_t nf = faces.size();
+	vector<TriMesh::Face> tmp(new_nf);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		int f = face_remap[i];
+		if (f < 0)
+			continue;
+		for (int j = 0; j < 3; j++) {
+			int other = across_edge[i][j];
+			tmp[f][j] = (other < 0) ? -1 : face_remap[other];
+		}
+	}
+
+	// The edges to fix, as (lower vertex, higher vertex)
+	vector<uint64_t> keys;
+	for (size_t r = 0; r < removed.size(); r++) {
+		const TriMesh::Face &f = faces[removed[r]];
+		for (int j = 0; j < 3; j++) {
+			int v1 = f[NEXT_MOD3(j)], v2 = f[PREV_MOD3(j)];
+			if (v1 != v2)
+				keys.push_back((uint64_t(min(v1, v2)) << 32) |
+				               unsigned(max(v1, v2)));
+		}
+	}
+	sort(keys.begin(), keys.end());
+	keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+	// Find the surviving half-edges of those edges, in the format used
+	// by match_half_edges (but with new face numbers)
+	vector< pair<uint64_t, uint64_t> > hes;
+#pragma omp parallel
+	{
+		vector< pair<uint64_t, uint64_t> > found;
+#pragma omp for nowait
+		for (ptrdiff_t i = 0; i < nf; i++) {
+			if (face_remap[i] < 0)
+				continue;
+			for (int j = 0; j < 3; j++) {
+				int v1 = faces[i][NEXT_MOD3(j)];
+				int v2 = faces[i][PREV_MOD3(j)];
+				if (v1 == v2 || slot[v1] < 0 || slot[v2] < 0)
 					continue;
-				if (faces[other][NEXT_MOD3(v2_in_other)] != v1)
+				uint64_t key = (uint64_t(min(v1, v2)) << 32) |
+				               unsigned(max(v1, v2));
+				if (!binary_search(keys.begin(), keys.end(), key))
 					continue;
-				across_edge[i][j] = other;
-				break;
+				uint64_t he = 3 * uint64_t(face_remap[i]) + j;
+				found.push_back(make_pair(key,
+					(he << 1) | uint64_t(v1 < v2)));
 			}
 		}
+#pragma omp critical
+		hes.insert(hes.end(), found.begin(), found.end());
+	}
+	sort(hes.begin(), hes.end());
+
+	vector<uint64_t> run;
+	for (size_t k = 0; k < hes.size(); ) {
+		run.clear();
+		uint64_t key = hes[k].first;
+		for ( ; k < hes.size() && hes[k].first == key; k++)
+			run.push_back(hes[k].second);
+		match_half_edges(&run[0], run.size(), tmp);
+	}
+	across_edge.swap(tmp);
+}
+
+
+// faceedges is renumbered, and edges used only by removed faces are
+// dropped.  The remaining edges keep their order.
+static void patch_edges(const vector<int> &face_remap,
+                        const vector<int> &removed,
+                        ptrdiff_t new_nf,
+                        vector<TriMesh::Edge> &edges,
+                        vector<TriMesh::Face> &faceedges)
+{
+	ptrdiff_t nf = faceedges.size(), ne = edges.size();
+	vector<TriMesh::Face> tmp(new_nf);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		if (face_remap[i] >= 0)
+			tmp[face_remap[i]] = faceedges[i];
 	}
 
+	// Which edges of the removed faces are still used?
+	vector<unsigned char> dead(ne);
+	for (size_t r = 0; r < removed.size(); r++) {
+		for (int j = 0; j < 3; j++) {
+			int e = faceedges[removed[r]][j];
+			if (e >= 0)
+				dead[e] = 1;
+		}
+	}
+	for (ptrdiff_t i = 0; i < new_nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			int e = tmp[i][j];
+			if (e >= 0)
+				dead[e] = 0;
+		}
+	}
+
+	vector<int> edge_remap(ne);
+	int next = 0;
+	for (ptrdiff_t e = 0; e < ne; e++) {
+		if (dead[e]) {
+			edge_remap[e] = -1;
+			continue;
+		}
+		edge_remap[e] = next;
+		edges[next++] = edges[e];
+	}
+	faceedges.swap(tmp);
+	if (next == ne)
+		return;
+
+	edges.resize(next);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < new_nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			int e = faceedges[i][j];
+			if (e >= 0)
+				faceedges[i][j] = edge_remap[e];
+		}
+	}
+}
+
+
+// Update the connectivity for the removal of some faces.  If only a few
+// faces are going away, each structure that is present is patched in
+// place, which is much cheaper than recomputing it.  Otherwise they are
+// all cleared, to be recomputed when needed.
+void TriMesh::patch_connectivity(const vector<int> &face_remap)
+{
+	clear_boundary_loops();
+	if (neighbors.empty() && adjacentfaces.empty() &&
+	    across_edge.empty() && edges.empty())
+		return;
+
+	ptrdiff_t nv = vertices.size(), nf = faces.size();
+	vector<int> removed;
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		if (face_remap[i] < 0)
+			removed.push_back(i);
+	}
+	if (removed.empty())
+		return;
+
+	// Neighbors can only be patched with the help of adjacentfaces
+	if (adjacentfaces.empty())
+		clear_neighbors();
+
+	if (removed.size() > size_t(nf / 8)) {
+		clear_neighbors();
+		clear_adjacentfaces();
+		clear_across_edge();
+		clear_edges();
+		return;
+	}
+
+	dprintf("Updating connectivity... ");
+	ptrdiff_t new_nf = nf - removed.size();
+	vector<int> slot(nv, -1), touched;
+	for (size_t r = 0; r < removed.size(); r++) {
+		for (int j = 0; j < 3; j++) {
+			int v = faces[removed[r]][j];
+			if (slot[v] < 0) {
+				slot[v] = touched.size();
+				touched.push_back(v);
+			}
+		}
+	}
+
+	if (!neighbors.empty())
+		patch_neighbors(faces, face_remap, touched, slot,
+		                adjacentfaces, neighbors);
+	if (!adjacentfaces.empty())
+		patch_adjacentfaces(face_remap, slot, adjacentfaces);
+	if (!across_edge.empty())
+		patch_across_edge(faces, face_remap, removed, slot,
+		                  new_nf, across_edge);
+	if (!edges.empty())
+		patch_edges(face_remap, removed, new_nf, edges, faceedges);
 	dprintf("Done.\n");
 }
 
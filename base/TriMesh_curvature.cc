@@ -9,11 +9,21 @@ Uses algorithm from
  Rusinkiewicz, Szymon.
  "Estimating Curvatures and Their Derivatives on Triangle Meshes,"
  Proc. 3DPVT, 2004.
+
+The per-face work is done in parallel, with each face's contributions to
+its vertices stored per corner and then added up at each vertex in face
+order, so the results do not depend on the number of threads.
+
+For point clouds, curvatures come from a least-squares fit of a quadric
+height field, over the tangent plane, to each point's nearest neighbors.
 */
 
 #include "trimesh2/TriMesh.h"
 #include "trimesh2/TriMesh_algo.h"
+#include "trimesh2/VertexBlocks.h"
+#include "trimesh2/FaceKernels.h"
 #include "trimesh2/lineqn.h"
+#include "trimesh2/KDtree.h"
 using namespace std;
 
 
@@ -139,105 +149,126 @@ void diagonalize_curv(const vec &old_u, const vec &old_v,
 }
 
 
+// Gather the batch of faces starting at first, and compute their
+// tangent frames
+static FACE_KERNEL void batch_frames(const vector<point> &vertices,
+	const vector<TriMesh::Face> &faces, ptrdiff_t first, FaceBatch &fb,
+	FaceBatch::Lanes (&t)[3], FaceBatch::Lanes (&b)[3])
+{
+	fb.gather(vertices, faces, first);
+	fb.frame(t, b);
+}
+
+
 // Compute principal curvatures and directions.
 void TriMesh::need_curvatures()
 {
 	if (curv1.size() == vertices.size())
 		return;
 	need_faces();
-	need_normals();
-	need_pointareas();
+	if (faces.empty()) {
+		need_point_curvatures();
+		return;
+	}
+	need(NEED_NORMALS | NEED_POINTAREAS);
 
 	dprintf("Computing curvatures... ");
 
 	// Resize the arrays we'll be using
-	int nv = vertices.size(), nf = faces.size();
+	ptrdiff_t nv = vertices.size(), nf = faces.size();
 	curv1.clear(); curv1.resize(nv); curv2.clear(); curv2.resize(nv);
 	pdir1.clear(); pdir1.resize(nv); pdir2.clear(); pdir2.resize(nv);
 	vector<float> curv12(nv);
 
-	// Set up an initial coordinate system per vertex
-	for (int i = 0; i < nf; i++) {
-		pdir1[faces[i][0]] = vertices[faces[i][1]] -
-		                     vertices[faces[i][0]];
-		pdir1[faces[i][1]] = vertices[faces[i][2]] -
-		                     vertices[faces[i][1]];
-		pdir1[faces[i][2]] = vertices[faces[i][0]] -
-		                     vertices[faces[i][2]];
-	}
-//#pragma omp parallel for
-	for (int i = 0; i < nv; i++) {
+	VertexCorners vc(faces, nv);
+
+	// Set up an initial coordinate system per vertex, from the last
+	// face that uses it
+	vc.for_each([&](ptrdiff_t v, ptrdiff_t i, int j) {
+		pdir1[v] = vertices[faces[i][NEXT_MOD3(j)]] - vertices[v];
+	});
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nv; i++) {
 		pdir1[i] = pdir1[i] TRICROSS normals[i];
 		normalize(pdir1[i]);
 		pdir2[i] = normals[i] TRICROSS pdir1[i];
 	}
 
-	// Compute curvature per-face
-//#pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		// Edges
-		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
-		             vertices[faces[i][0]] - vertices[faces[i][2]],
-		             vertices[faces[i][1]] - vertices[faces[i][0]] };
-
-		// N-T-B coordinate system per face
-		vec t = e[0];
-		normalize(t);
-		vec n = e[0] TRICROSS e[1];
-		vec b = n TRICROSS t;
-		normalize(b);
-
-		// Estimate curvature based on variation of normals
-		// along edges
-		float m[3] = { 0, 0, 0 };
-		float w[3][3] = { {0,0,0}, {0,0,0}, {0,0,0} };
-		for (int j = 0; j < 3; j++) {
-			float u = e[j] DOT t;
-			float v = e[j] DOT b;
-			w[0][0] += u*u;
-			w[0][1] += u*v;
-			w[2][2] += v*v;
-			// The below are computed once at the end of the loop
-			// w[1][1] += v*v + u*u;
-			// w[1][2] += u*v;
-			vec dn = normals[faces[i][PREV_MOD3(j)]] -
-			         normals[faces[i][NEXT_MOD3(j)]];
-			float dnu = dn DOT t;
-			float dnv = dn DOT b;
-			m[0] += dnu*u;
-			m[1] += dnu*v + dnv*u;
-			m[2] += dnv*v;
-		}
-		w[1][1] = w[0][0] + w[2][2];
-		w[1][2] = w[0][1];
-
-		// Least squares solution
-		float diag[3];
-		if (!ldltdc<float,3>(w, diag)) {
-			//dprintf("ldltdc failed!\n");
-			continue;
-		}
-		ldltsl<float,3>(w, diag, m, m);
-
-		// Push it back out to the vertices
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			float c1, c12, c2;
-			proj_curv(t, b, m[0], m[1], m[2],
-			          pdir1[vj], pdir2[vj], c1, c12, c2);
-			float wt = cornerareas[i][j] / pointareas[vj];
-//#pragma omp atomic
-			curv1[vj]  += wt * c1;
-//#pragma omp atomic
-			curv12[vj] += wt * c12;
-//#pragma omp atomic
-			curv2[vj]  += wt * c2;
+	// Compute curvature per-face, and its contribution to each corner's
+	// vertex.  Faces for which the solve fails contribute zero.
+	vector<vec> cornercurv(3 * nf);
+#pragma omp parallel for
+	for (ptrdiff_t first = 0; first < nf; first += FaceBatch::N) {
+		FaceBatch fb;
+		FaceBatch::Lanes bt[3], bb[3];
+		batch_frames(vertices, faces, first, fb, bt, bb);
+		for (int k = 0; k < fb.n; k++) {
+			ptrdiff_t i = first + k;
+
+			// Edges
+			vec e[3];
+			for (int j = 0; j < 3; j++)
+				e[j] = vec(fb.e[j][0][k], fb.e[j][1][k], fb.e[j][2][k]);
+
+			// N-T-B coordinate system per face
+			vec t(bt[0][k], bt[1][k], bt[2][k]);
+			vec b(bb[0][k], bb[1][k], bb[2][k]);
+
+			// Estimate curvature based on variation of normals
+			// along edges
+			float m[3] = { 0, 0, 0 };
+			float w[3][3] = { {0,0,0}, {0,0,0}, {0,0,0} };
+			for (int j = 0; j < 3; j++) {
+				float u = e[j] DOT t;
+				float v = e[j] DOT b;
+				w[0][0] += u*u;
+				w[0][1] += u*v;
+				w[2][2] += v*v;
+				// The below are computed once at the end of the loop
+				// w[1][1] += v*v + u*u;
+				// w[1][2] += u*v;
+				vec dn = normals[faces[i][PREV_MOD3(j)]] -
+				         normals[faces[i][NEXT_MOD3(j)]];
+				float dnu = dn DOT t;
+				float dnv = dn DOT b;
+				m[0] += dnu*u;
+				m[1] += dnu*v + dnv*u;
+				m[2] += dnv*v;
+			}
+			w[1][1] = w[0][0] + w[2][2];
+			w[1][2] = w[0][1];
+
+			// Least squares solution
+			float diag[3];
+			if (!ldltdc<float,3>(w, diag)) {
+				//dprintf("ldltdc failed!\n");
+				continue;
+			}
+			ldltsl<float,3>(w, diag, m, m);
+
+			// Push it back out to the vertices
+			for (int j = 0; j < 3; j++) {
+				int vj = faces[i][j];
+				float c1, c12, c2;
+				proj_curv(t, b, m[0], m[1], m[2],
+				          pdir1[vj], pdir2[vj], c1, c12, c2);
+				float wt = cornerareas[i][j] / pointareas[vj];
+				cornercurv[3*i+j] = vec(wt * c1, wt * c12, wt * c2);
+			}
 		}
 	}
 
+	// Add them up at each vertex
+	vc.for_each([&](ptrdiff_t v, ptrdiff_t i, int j) {
+		const vec &c = cornercurv[3*i+j];
+		curv1[v]  += c[0];
+		curv12[v] += c[1];
+		curv2[v]  += c[2];
+	});
+
 	// Compute principal directions and curvatures at each vertex
-//#pragma omp parallel for
-	for (int i = 0; i < nv; i++) {
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nv; i++) {
 		diagonalize_curv(pdir1[i], pdir2[i],
 		                 curv1[i], curv12[i], curv2[i],
 		                 normals[i], pdir1[i], pdir2[i],
@@ -247,6 +278,81 @@ void TriMesh::need_curvatures()
 }
 
 
+// Compute principal curvatures and directions of a point cloud
+void TriMesh::need_point_curvatures(int k /* = 20 */, float maxdist /* = 0 */)
+{
+	ptrdiff_t nv = vertices.size();
+	if (!nv || ptrdiff_t(curv1.size()) == nv)
+		return;
+	need_normals();
+
+	dprintf("Computing curvatures from points... ");
+	curv1.clear(); curv1.resize(nv); curv2.clear(); curv2.resize(nv);
+	pdir1.clear(); pdir1.resize(nv); pdir2.clear(); pdir2.resize(nv);
+
+	KDtree kd(vertices);
+	vector<const float *> knn;
+	kd.find_k_closest_to_pts(knn, k, &vertices[0][0], nv, sqr(maxdist));
+
+#pragma omp parallel for schedule(dynamic,1024)
+	for (ptrdiff_t i = 0; i < nv; i++) {
+		// Tangent frame
+		const vec &n = normals[i];
+		vec u = (fabs(n[0]) > 0.5f) ? vec(0,1,0) TRICROSS n :
+		                              vec(1,0,0) TRICROSS n;
+		normalize(u);
+		vec v = n TRICROSS u;
+
+		// Neighbors in the frame, scaled by the distance to the
+		// farthest one to keep the fit well-conditioned
+		const float * const *nbr = &knn[size_t(k)*i];
+		int actual_k = 0;
+		while (actual_k < k && nbr[actual_k])
+			actual_k++;
+		float scale = actual_k ?
+			dist(vertices[i], point(nbr[actual_k-1])) : 0.0f;
+		// Too few neighbors to fit, or all of them on top of this
+		// point: leave the curvature at zero
+		if (actual_k < 5 || scale == 0.0f) {
+			pdir1[i] = u;
+			pdir2[i] = v;
+			continue;
+		}
+		float iscale = 1.0f / scale;
+
+		// Fit h = a x^2 + b xy + c y^2 + d x + e y.  The linear terms
+		// absorb any tilt of the normal.
+		float A[5][5] = { { 0 } }, rhs[5] = { 0 };
+		for (int j = 0; j < actual_k; j++) {
+			vec d = iscale * (point(nbr[j]) - vertices[i]);
+			float x = d DOT u, y = d DOT v, h = d DOT n;
+			float row[5] = { x * x, x * y, y * y, x, y };
+			for (int l = 0; l < 5; l++) {
+				for (int m = l; m < 5; m++)
+					A[l][m] += row[l] * row[m];
+				rhs[l] += row[l] * h;
+			}
+		}
+		float rdiag[5];
+		if (!ldltdc<float,5>(A, rdiag)) {
+			pdir1[i] = u;
+			pdir2[i] = v;
+			continue;
+		}
+		ldltsl<float,5>(A, rdiag, rhs);
+
+		// The second fundamental form, undoing the scaling.  Curvature
+		// is positive where the surface bends away from the normal.
+		float w = -iscale / sqrt(1.0f + sqr(rhs[3]) + sqr(rhs[4]));
+		diagonalize_curv(u, v, w * 2.0f * rhs[0], w * rhs[1],
+		                 w * 2.0f * rhs[2], n,
+		                 pdir1[i], pdir2[i], curv1[i], curv2[i]);
+	}
+
+	dprintf("Done.\n");
+}
+
+
 // Compute derivatives of curvature.
 void TriMesh::need_dcurv()
 {
@@ -257,81 +363,93 @@ void TriMesh::need_dcurv()
 	dprintf("Computing dcurv... ");
 
 	// Resize the arrays we'll be using
-	int nv = vertices.size(), nf = faces.size();
+	ptrdiff_t nv = vertices.size(), nf = faces.size();
 	dcurv.clear(); dcurv.resize(nv);
 
-	// Compute dcurv per-face
-//#pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		// Edges
-		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
-		             vertices[faces[i][0]] - vertices[faces[i][2]],
-		             vertices[faces[i][1]] - vertices[faces[i][0]] };
-
-		// N-T-B coordinate system per face
-		vec t = e[0];
-		normalize(t);
-		vec n = e[0] TRICROSS e[1];
-		vec b = n TRICROSS t;
-		normalize(b);
-
-		// Project curvature tensor from each vertex into this
-		// face's coordinate system
-		vec fcurv[3];
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			proj_curv(pdir1[vj], pdir2[vj], curv1[vj], 0, curv2[vj],
-			          t, b, fcurv[j][0], fcurv[j][1], fcurv[j][2]);
-
-		}
-
-		// Estimate dcurv based on variation of curvature along edges
-		float m[4] = { 0, 0, 0, 0 };
-		float w[4][4] = { {0,0,0,0}, {0,0,0,0}, {0,0,0,0}, {0,0,0,0} };
-		for (int j = 0; j < 3; j++) {
-			// Variation of curvature along each edge
-			vec dfcurv = fcurv[PREV_MOD3(j)] - fcurv[NEXT_MOD3(j)];
-			float u = e[j] DOT t;
-			float v = e[j] DOT b;
-			float u2 = u*u, v2 = v*v, uv = u*v;
-			w[0][0] += u2;
-			w[0][1] += uv;
-			w[3][3] += v2;
-			// All the below are computed at the end of the loop
-			// w[1][1] += 2.0f*u2 + v2;
-			// w[1][2] += 2.0f*uv;
-			// w[2][2] += u2 + 2.0f*v2;
-			// w[2][3] += uv;
-			m[0] += u*dfcurv[0];
-			m[1] += v*dfcurv[0] + 2.0f*u*dfcurv[1];
-			m[2] += 2.0f*v*dfcurv[1] + u*dfcurv[2];
-			m[3] += v*dfcurv[2];
-		}
-		w[1][1] = 2.0f * w[0][0] + w[3][3];
-		w[1][2] = 2.0f * w[0][1];
-		w[2][2] = w[0][0] + 2.0f * w[3][3];
-		w[2][3] = w[0][1];
-
-		// Least squares solution
-		float d[4];
-		if (!ldltdc<float,4>(w, d)) {
-			//dprintf("ldltdc failed!\n");
-			continue;
-		}
-		ldltsl<float,4>(w, d, m, m);
-		Vec<4> face_dcurv(m);
-
-		// Push it back out to each vertex
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			Vec<4> this_vert_dcurv;
-			proj_dcurv(t, b, face_dcurv,
-			           pdir1[vj], pdir2[vj], this_vert_dcurv);
-			float wt = cornerareas[i][j] / pointareas[vj];
-			dcurv[vj] += wt * this_vert_dcurv;
+	// Compute dcurv per-face, and its contribution to each corner's
+	// vertex.  Faces for which the solve fails contribute zero.
+	vector< Vec<4> > cornerdcurv(3 * nf);
+#pragma omp parallel for
+	for (ptrdiff_t first = 0; first < nf; first += FaceBatch::N) {
+		FaceBatch fb;
+		FaceBatch::Lanes bt[3], bb[3];
+		batch_frames(vertices, faces, first, fb, bt, bb);
+		for (int k = 0; k < fb.n; k++) {
+			ptrdiff_t i = first + k;
+
+			// Edges
+			vec e[3];
+			for (int j = 0; j < 3; j++)
+				e[j] = vec(fb.e[j][0][k], fb.e[j][1][k], fb.e[j][2][k]);
+
+			// N-T-B coordinate system per face
+			vec t(bt[0][k], bt[1][k], bt[2][k]);
+			vec b(bb[0][k], bb[1][k], bb[2][k]);
+
+			// Project curvature tensor from each vertex into this
+			// face's coordinate system
+			vec fcurv[3];
+			for (int j = 0; j < 3; j++) {
+				int vj = faces[i][j];
+				proj_curv(pdir1[vj], pdir2[vj], curv1[vj], 0, curv2[vj],
+				          t, b, fcurv[j][0], fcurv[j][1], fcurv[j][2]);
+
+			}
+
+			// Estimate dcurv based on variation of curvature along edges
+			float m[4] = { 0, 0, 0, 0 };
+			float w[4][4] = { {0,0,0,0}, {0,0,0,0}, {0,0,0,0}, {0,0,0,0} };
+			for (int j = 0; j < 3; j++) {
+				// Variation of curvature along each edge
+				vec dfcurv = fcurv[PREV_MOD3(j)] - fcurv[NEXT_MOD3(j)];
+				float u = e[j] DOT t;
+				float v = e[j] DOT b;
+				float u2 = u*u, v2 = v*v, uv = u*v;
+				w[0][0] += u2;
+				w[0][1] += uv;
+				w[3][3] += v2;
+				// All the below are computed at the end of the loop
+				// w[1][1] += 2.0f*u2 + v2;
+				// w[1][2] += 2.0f*uv;
+				// w[2][2] += u2 + 2.0f*v2;
+				// w[2][3] += uv;
+				m[0] += u*dfcurv[0];
+				m[1] += v*dfcurv[0] + 2.0f*u*dfcurv[1];
+				m[2] += 2.0f*v*dfcurv[1] + u*dfcurv[2];
+				m[3] += v*dfcurv[2];
+			}
+			w[1][1] = 2.0f * w[0][0] + w[3][3];
+			w[1][2] = 2.0f * w[0][1];
+			w[2][2] = w[0][0] + 2.0f * w[3][3];
+			w[2][3] = w[0][1];
+
+			// Least squares solution
+			float d[4];
+			if (!ldltdc<float,4>(w, d)) {
+				//dprintf("ldltdc failed!\n");
+				continue;
+			}
+			ldltsl<float,4>(w, d, m, m);
+			Vec<4> face_dcurv(m);
+
+			// Push it back out to each vertex
+			for (int j = 0; j < 3; j++) {
+				int vj = faces[i][j];
+				Vec<4> this_vert_dcurv;
+				proj_dcurv(t, b, face_dcurv,
+				           pdir1[vj], pdir2[vj], this_vert_dcurv);
+				float wt = cornerareas[i][j] / pointareas[vj];
+				cornerdcurv[3*i+j] = wt * this_vert_dcurv;
+			}
 		}
 	}
 
+	// Add them up at each vertex
+	VertexCorners vc(faces, nv);
+	vc.for_each([&](ptrdiff_t v, ptrdiff_t i, int j) {
+		dcurv[v] += cornerdcurv[3*i+j];
+	});
+
 	dprintf("Done.\n");
 }
 
@@ -25,7 +25,7 @@ void TriMesh::triangulate_grid(bool remove_slivers /* = true */)
 {
 	dprintf("Triangulating... ");
 
-	int nv = vertices.size();
+	ptrdiff_t nv = vertices.size();
 	int ngrid = grid_width * grid_height;
 
 	// Work around broken files that have a vertex position of (0,0,0)
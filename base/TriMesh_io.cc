@@ -2266,10 +2266,10 @@ static bool write_stl(TriMesh *mesh, FILE *f)
 		swap_int(nfaces);
 	FWRITE(&nfaces, 4, 1, f);
 
+	mesh->need_facenormals();
 	for (size_t i = 0; i < mesh->faces.size(); i++) {
 		float fbuf[12];
-		vec tn = mesh->trinorm(i);
-		normalize(tn);
+		const vec &tn = mesh->facenormals[i];
 		fbuf[0] = tn[0]; fbuf[1] = tn[1]; fbuf[2] = tn[2];
 		fbuf[3]  = mesh->vertices[mesh->faces[i][0]][0];
 		fbuf[4]  = mesh->vertices[mesh->faces[i][0]][1];
@@ -0,0 +1,180 @@
+/*
+TriMesh_need.cc
+Computing several derived quantities at once, overlapping those that do
+not depend on each other.
+*/
+
+#include "trimesh2/TriMesh.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <algorithm>
+using namespace std;
+
+
+namespace trimesh {
+
+// Each quantity, and all the quantities its need_*() function reads,
+// whether it computes them itself (which is not safe to do concurrently)
+// or relies on them having been computed along the way, as need_dcurv()
+// does with the point areas
+static const struct {
+	unsigned what, deps;
+} need_graph[] = {
+	{ TriMesh::NEED_FACES,          0 },
+	{ TriMesh::NEED_NORMALS,        TriMesh::NEED_FACES },
+	{ TriMesh::NEED_CURVATURES,     TriMesh::NEED_FACES |
+	                                TriMesh::NEED_NORMALS |
+	                                TriMesh::NEED_POINTAREAS },
+	{ TriMesh::NEED_DCURV,          TriMesh::NEED_FACES |
+	                                TriMesh::NEED_CURVATURES |
+	                                TriMesh::NEED_POINTAREAS },
+	{ TriMesh::NEED_POINTAREAS,     TriMesh::NEED_FACES },
+	{ TriMesh::NEED_FACENORMALS,    TriMesh::NEED_FACES },
+	{ TriMesh::NEED_FACEAREAS,      TriMesh::NEED_FACES },
+	{ TriMesh::NEED_BBOX,           0 },
+	{ TriMesh::NEED_BSPHERE,        TriMesh::NEED_BBOX },
+	{ TriMesh::NEED_NEIGHBORS,      TriMesh::NEED_FACES },
+	{ TriMesh::NEED_ADJACENTFACES,  TriMesh::NEED_FACES },
+	{ TriMesh::NEED_ACROSS_EDGE,    TriMesh::NEED_FACES },
+	{ TriMesh::NEED_EDGES,          TriMesh::NEED_FACES },
+	{ TriMesh::NEED_BOUNDARY_LOOPS, TriMesh::NEED_FACES |
+	                                TriMesh::NEED_ACROSS_EDGE },
+};
+static const int n_need_graph = sizeof(need_graph) / sizeof(need_graph[0]);
+
+
+// Is the quantity already there?  Errs on the side of "no" (for example,
+// for connectivity of a mesh without faces), since need_*() will then
+// just return.
+static bool have(const TriMesh *mesh, unsigned what)
+{
+	size_t nv = mesh->vertices.size(), nf = mesh->faces.size();
+	switch (what) {
+		case TriMesh::NEED_FACES:
+			return nf || (mesh->tstrips.empty() && mesh->grid.empty());
+		case TriMesh::NEED_NORMALS:
+			return mesh->normals.size() == nv;
+		case TriMesh::NEED_CURVATURES:
+			return mesh->curv1.size() == nv;
+		case TriMesh::NEED_DCURV:
+			return mesh->dcurv.size() == nv;
+		case TriMesh::NEED_POINTAREAS:
+			return mesh->pointareas.size() == nv;
+		case TriMesh::NEED_FACENORMALS:
+			return nf && mesh->facenormals.size() == nf;
+		case TriMesh::NEED_FACEAREAS:
+			return nf && mesh->faceareas.size() == nf;
+		case TriMesh::NEED_BBOX:
+			return !nv || mesh->bbox.valid;
+		case TriMesh::NEED_BSPHERE:
+			return !nv || mesh->bsphere.valid;
+		case TriMesh::NEED_NEIGHBORS:
+			return !mesh->neighbors.empty();
+		case TriMesh::NEED_ADJACENTFACES:
+			return !mesh->adjacentfaces.empty();
+		case TriMesh::NEED_ACROSS_EDGE:
+			return !mesh->across_edge.empty();
+		case TriMesh::NEED_EDGES:
+			return !mesh->edges.empty();
+		case TriMesh::NEED_BOUNDARY_LOOPS:
+			return !mesh->boundary_loops.empty();
+	}
+	return true;
+}
+
+
+// Compute one quantity
+static void need_one(TriMesh *mesh, unsigned what)
+{
+	switch (what) {
+		case TriMesh::NEED_FACES:          mesh->need_faces(); break;
+		case TriMesh::NEED_NORMALS:        mesh->need_normals(); break;
+		case TriMesh::NEED_CURVATURES:     mesh->need_curvatures(); break;
+		case TriMesh::NEED_DCURV:          mesh->need_dcurv(); break;
+		case TriMesh::NEED_POINTAREAS:     mesh->need_pointareas(); break;
+		case TriMesh::NEED_FACENORMALS:    mesh->need_facenormals(); break;
+		case TriMesh::NEED_FACEAREAS:      mesh->need_faceareas(); break;
+		case TriMesh::NEED_BBOX:           mesh->need_bbox(); break;
+		case TriMesh::NEED_BSPHERE:        mesh->need_bsphere(); break;
+		case TriMesh::NEED_NEIGHBORS:      mesh->need_neighbors(); break;
+		case TriMesh::NEED_ADJACENTFACES:  mesh->need_adjacentfaces(); break;
+		case TriMesh::NEED_ACROSS_EDGE:    mesh->need_across_edge(); break;
+		case TriMesh::NEED_EDGES:          mesh->need_edges(); break;
+		case TriMesh::NEED_BOUNDARY_LOOPS: mesh->need_boundary_loops(); break;
+	}
+}
+
+
+// Compute the requested quantities and everything they depend on.  This
+// proceeds in rounds: each round computes everything whose dependencies
+// are all present.  The quantities in a round are computed concurrently,
+// each by its own share of the threads: most need_*() functions have
+// parallel loops of their own, which then run as nested parallel regions
+// on a sub-team.  Each quantity is written only by its own need_*(), and
+// only reads quantities from earlier rounds, so the results are the same
+// as computing each quantity by itself.
+void TriMesh::need(unsigned what)
+{
+	// Add dependencies, until nothing changes
+	unsigned old_what;
+	do {
+		old_what = what;
+		for (int i = 0; i < n_need_graph; i++) {
+			if (what & need_graph[i].what)
+				what |= need_graph[i].deps;
+		}
+	} while (what != old_what);
+
+	// Drop what is already there
+	for (int i = 0; i < n_need_graph; i++) {
+		if ((what & need_graph[i].what) && have(this, need_graph[i].what))
+			what &= ~need_graph[i].what;
+	}
+
+	int nthreads = 1;
+#ifdef _OPENMP
+	if (!omp_in_parallel())
+		nthreads = omp_get_max_threads();
+#endif
+
+	while (what) {
+		// Everything that does not depend on something still to come
+		unsigned round[n_need_graph];
+		int nround = 0;
+		for (int i = 0; i < n_need_graph; i++) {
+			if ((what & need_graph[i].what) &&
+			    !(what & need_graph[i].deps))
+				round[nround++] = need_graph[i].what;
+		}
+		if (!nround)
+			break;
+
+		if (nthreads == 1 || nround == 1) {
+			for (int i = 0; i < nround; i++)
+				need_one(this, round[i]);
+		} else {
+#ifdef _OPENMP
+			int nteam = min(nround, nthreads);
+			int nsub = max(1, nthreads / nteam);
+			int old_levels = omp_get_max_active_levels();
+			if (old_levels < 2)
+				omp_set_max_active_levels(2);
+#pragma omp parallel num_threads(nteam)
+			{
+				omp_set_num_threads(nsub);
+#pragma omp for schedule(dynamic, 1)
+				for (int i = 0; i < nround; i++)
+					need_one(this, round[i]);
+			}
+			if (old_levels < 2)
+				omp_set_max_active_levels(old_levels);
+#endif
+		}
+
+		for (int i = 0; i < nround; i++)
+			what &= ~round[i];
+	}
+}
+
+} // namespace trimesh
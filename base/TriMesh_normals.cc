@@ -11,12 +11,25 @@ For meshes, uses average of per-face normals, weighted according to:
   Journal of Graphics Tools, Vol. 4, No. 2, 1999.
 unless need_normals(true) is called.
 
-For raw point clouds, fits plane to k nearest neighbors.
+For raw point clouds, fits plane to k nearest neighbors, then orients
+the normals consistently by propagating along a minimum spanning tree of
+the neighbor graph, following
+  Hoppe, H., DeRose, T., Duchamp, T., McDonald, J., and Stuetzle, W.
+  "Surface Reconstruction from Unorganized Points,"
+  Proc. SIGGRAPH, 1992.
+or by turning each toward a viewpoint, if one is given.
+
+Also computes per-face normals and areas.
 */
 
 #include "trimesh2/TriMesh.h"
 #include "trimesh2/KDtree.h"
+#include "trimesh2/VertexBlocks.h"
+#include "trimesh2/FaceKernels.h"
 #include "trimesh2/lineqn.h"
+#include <queue>
+#include <functional>
+#include <limits>
 using namespace std;
 
 
@@ -120,71 +133,130 @@ static void normals_from_tstrips_area(vector<int> &tstrips,
 }
 
 
-// Compute from faces, Max-weighted
-static void normals_from_faces_Max(vector<TriMesh::Face> &faces,
-	vector<point> &vertices, vector<vec> &normals)
+// The Max-weighted normal of a face: the (unnormalized) face normal, and
+// its weight at each corner.  Degenerate faces are left out.
+struct MaxFaceNormal {
+	vec n;
+	float w[3];
+	bool used;
+};
+
+
+// Max-weighted normals of the batch of faces starting at first
+static FACE_KERNEL void batch_normals_Max(const vector<TriMesh::Face> &faces,
+	const vector<point> &vertices, ptrdiff_t first,
+	vector<MaxFaceNormal> &facenormals)
 {
-	int nf = faces.size();
-//#pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		const point &p0 = vertices[faces[i][0]];
-		const point &p1 = vertices[faces[i][1]];
-		const point &p2 = vertices[faces[i][2]];
-		vec a = p0 - p1, b = p1 - p2, c = p2 - p0;
-		float l2a = len2(a), l2b = len2(b), l2c = len2(c);
-		if (!l2a || !l2b || !l2c)
+	FaceBatch fb;
+	fb.gather(vertices, faces, first);
+	FaceBatch::Lanes fn[3];
+	fb.cross(2, 0, fn);
+	for (int k = 0; k < fb.n; k++) {
+		float l2a = fb.l2[2][k], l2b = fb.l2[0][k], l2c = fb.l2[1][k];
+		MaxFaceNormal &f = facenormals[first+k];
+		f.used = l2a && l2b && l2c;
+		if (!f.used)
 			continue;
-		vec facenormal = a TRICROSS b;
-		normals[faces[i][0]] += facenormal * (1.0f / (l2a * l2c));
-		normals[faces[i][1]] += facenormal * (1.0f / (l2b * l2a));
-		normals[faces[i][2]] += facenormal * (1.0f / (l2c * l2b));
+		f.n = vec(fn[0][k], fn[1][k], fn[2][k]);
+		f.w[0] = 1.0f / (l2a * l2c);
+		f.w[1] = 1.0f / (l2b * l2a);
+		f.w[2] = 1.0f / (l2c * l2b);
 	}
 }
 
 
+// Compute from faces, Max-weighted.  The face normals are computed in
+// parallel over the faces, then added up in parallel over the vertices
+// (see VertexBlocks.h), so the result is the same as if computed serially.
+static void normals_from_faces_Max(vector<TriMesh::Face> &faces,
+	vector<point> &vertices, vector<vec> &normals)
+{
+	ptrdiff_t nf = faces.size();
+	vector<MaxFaceNormal> facenormals(nf);
+#pragma omp parallel for
+	for (ptrdiff_t first = 0; first < nf; first += FaceBatch::N)
+		batch_normals_Max(faces, vertices, first, facenormals);
+
+	VertexCorners vc(faces, vertices.size());
+	vc.for_each([&](ptrdiff_t v, ptrdiff_t i, int j) {
+		const MaxFaceNormal &f = facenormals[i];
+		if (f.used)
+			normals[v] += f.n * f.w[j];
+	});
+}
+
+
+// As above, area-weighted
+static FACE_KERNEL void batch_normals_area(const vector<TriMesh::Face> &faces,
+	const vector<point> &vertices, ptrdiff_t first,
+	vector<vec> &facenormals)
+{
+	FaceBatch fb;
+	fb.gather(vertices, faces, first);
+	FaceBatch::Lanes fn[3];
+	fb.cross(2, 0, fn);
+	for (int k = 0; k < fb.n; k++)
+		facenormals[first+k] = vec(fn[0][k], fn[1][k], fn[2][k]);
+}
+
+
 // Compute from faces, area-weighted
 static void normals_from_faces_area(vector<TriMesh::Face> &faces,
 	vector<point> &vertices, vector<vec> &normals)
 {
-	int nf = faces.size();
-//#pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		const point &p0 = vertices[faces[i][0]];
-		const point &p1 = vertices[faces[i][1]];
-		const point &p2 = vertices[faces[i][2]];
-		vec a = p0 - p1, b = p1 - p2;
-		vec facenormal = a TRICROSS b;
-		normals[faces[i][0]] += facenormal;
-		normals[faces[i][1]] += facenormal;
-		normals[faces[i][2]] += facenormal;
-	}
+	ptrdiff_t nf = faces.size();
+	vector<vec> facenormals(nf);
+#pragma omp parallel for
+	for (ptrdiff_t first = 0; first < nf; first += FaceBatch::N)
+		batch_normals_area(faces, vertices, first, facenormals);
+
+	VertexCorners vc(faces, vertices.size());
+	vc.for_each([&](ptrdiff_t v, ptrdiff_t i, int) {
+		normals[v] += facenormals[i];
+	});
 }
 
 
-// Compute from points, fitting plane to k-nn
-static void normals_from_points(vector<point> &vertices, vector<vec> &normals)
+// Compute from points, fitting plane to the k nearest neighbors of each
+// point within maxdist (if nonzero).  The neighbors of point i are left
+// in nbrs[k*i] through nbrs[k*i+k-1], padded with -1.
+static void normals_from_points(const vector<point> &vertices,
+	vector<vec> &normals, int k, float maxdist, vector<int> &nbrs)
 {
-	const int k = 6;
 	const vec ref(0, 0, 1);
-	const float approx_eps = 0.05f;
 	KDtree kd(vertices);
-	int nv = vertices.size();
-//#pragma omp parallel for
-	for (int i = 0; i < nv; i++) {
-		vector<const float *> knn;
-		kd.find_k_closest_to_pt(knn, k, vertices[i], approx_eps);
-		int actual_k = knn.size();
-		if (actual_k < 3) {
-			TriMesh::dprintf("Warning: not enough points for vertex %d\n", i);
+	ptrdiff_t nv = vertices.size();
+	float maxdist2 = sqr(maxdist);
+	vector<const float *> knn;
+	kd.find_k_closest_to_pts(knn, k, &vertices[0][0], nv, maxdist2);
+	nbrs.clear();
+	nbrs.resize(size_t(k) * nv, -1);
+#pragma omp parallel for schedule(dynamic,1024)
+	for (ptrdiff_t i = 0; i < nv; i++) {
+		const float * const *nbr = &knn[size_t(k)*i];
+		int actual_k = 0;
+		while (actual_k < k && nbr[actual_k]) {
+			nbrs[size_t(k)*i+actual_k] =
+				(nbr[actual_k] - &vertices[0][0]) / 3;
+			actual_k++;
+		}
+		if (actual_k < 2) {
+			TriMesh::dprintf("Warning: not enough points for vertex %ld\n",
+				(long) i);
 			normals[i] = ref;
 			continue;
 		}
-		// Compute covariance
+
+		// Compute covariance about the centroid of the point and its
+		// neighbors.  The KDtree does not return vertices[i] itself,
+		// so these are all distinct.
+		point c = vertices[i];
+		for (int j = 0; j < actual_k; j++)
+			c += point(nbr[j]);
+		c /= float(actual_k + 1);
 		float C[3][3] = { { 0 } };
-		// The KDtree does not return vertices[i] itself, so
-		// these are all valid neighbors
-		for (int j = 0; j < actual_k; j++) {
-			vec d = point(knn[j]) - vertices[i];
+		for (int j = -1; j < actual_k; j++) {
+			vec d = ((j < 0) ? vertices[i] : point(nbr[j])) - c;
 			for (int l = 0; l < 3; l++)
 				for (int m = 0; m < 3; m++)
 					C[l][m] += d[l] * d[m];
@@ -198,13 +270,131 @@ static void normals_from_points(vector<point> &vertices, vector<vec> &normals)
 }
 
 
+// Orient normals consistently: starting from the highest point not yet
+// reached (whose normal is made to point up), grow a minimum spanning
+// tree over the neighbor graph with cost 1 - |n1 DOT n2|, flipping each
+// normal to agree with its parent.  This crosses from one point to the
+// next where the surface is flattest first, so it avoids jumping
+// between nearby sheets or across sharp edges where possible.
+static void orient_point_normals(const vector<point> &vertices,
+	vector<vec> &normals, int k, const vector<int> &nbrs)
+{
+	ptrdiff_t nv = vertices.size();
+
+	// Make the neighbor graph symmetric
+	vector<int> sizes(nv);
+	for (ptrdiff_t i = 0; i < nv; i++) {
+		for (int j = 0; j < k; j++) {
+			int n = nbrs[size_t(k)*i+j];
+			if (n < 0)
+				break;
+			sizes[i]++;
+			sizes[n]++;
+		}
+	}
+	Adjacency graph;
+	graph.set_sizes(sizes);
+	vector<size_t> pos(graph.offsets.begin(), graph.offsets.end() - 1);
+	for (ptrdiff_t i = 0; i < nv; i++) {
+		for (int j = 0; j < k; j++) {
+			int n = nbrs[size_t(k)*i+j];
+			if (n < 0)
+				break;
+			graph.indices[pos[i]++] = n;
+			graph.indices[pos[n]++] = i;
+		}
+	}
+
+	// Seeds, highest first
+	vector<int> order(nv);
+	for (ptrdiff_t i = 0; i < nv; i++)
+		order[i] = i;
+	sort(order.begin(), order.end(), [&](int a, int b) {
+		return vertices[a][2] > vertices[b][2] ||
+			(vertices[a][2] == vertices[b][2] && a < b);
+	});
+
+	// Prim's algorithm.  Queue entries are (cost, to, from), smallest
+	// first, with ties broken by index so the result is deterministic.
+	typedef pair<float, pair<int,int> > Entry;
+	priority_queue<Entry, vector<Entry>, greater<Entry> > q;
+	vector<bool> done(nv);
+	vector<float> best(nv, numeric_limits<float>::max());
+	for (ptrdiff_t s = 0; s < nv; s++) {
+		int seed = order[s];
+		if (done[seed])
+			continue;
+		if (normals[seed][2] < 0.0f)
+			normals[seed] = -normals[seed];
+		q.push(Entry(0.0f, make_pair(seed, seed)));
+		while (!q.empty()) {
+			int v = q.top().second.first, from = q.top().second.second;
+			q.pop();
+			if (done[v])
+				continue;
+			done[v] = true;
+			if ((normals[v] DOT normals[from]) < 0.0f)
+				normals[v] = -normals[v];
+			for (int n : graph[v]) {
+				if (done[n])
+					continue;
+				float cost = 1.0f - fabs(normals[v] DOT normals[n]);
+				if (cost >= best[n])
+					continue;
+				best[n] = cost;
+				q.push(Entry(cost, make_pair(n, v)));
+			}
+		}
+	}
+}
+
+
+// Compute normals for a point cloud, ignoring any faces
+void TriMesh::need_point_normals(int k /* = 10 */, float maxdist /* = 0 */,
+                                 const point *viewpoint /* = NULL */)
+{
+	ptrdiff_t nv = vertices.size();
+	if (!nv || ptrdiff_t(normals.size()) == nv)
+		return;
+
+	dprintf("Computing normals from points... ");
+	normals.clear();
+	normals.resize(nv);
+
+	vector<int> nbrs;
+	normals_from_points(vertices, normals, k, maxdist, nbrs);
+	if (viewpoint) {
+		const point &vp = *viewpoint;
+#pragma omp parallel for
+		for (ptrdiff_t i = 0; i < nv; i++) {
+			if (((vp - vertices[i]) DOT normals[i]) < 0.0f)
+				normals[i] = -normals[i];
+		}
+	} else {
+		orient_point_normals(vertices, normals, k, nbrs);
+	}
+
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nv; i++)
+		normalize(normals[i]);
+
+	dprintf("Done.\n");
+}
+
+
 // Compute per-vertex normals
 void TriMesh::need_normals(bool simple_area_weighted /* = false */)
 {
 	// Nothing to do if we already have normals
-	int nv = vertices.size();
-	if (!nv || int(normals.size()) == nv)
+	ptrdiff_t nv = vertices.size();
+	if (!nv || ptrdiff_t(normals.size()) == nv)
+		return;
+
+	// Point clouds get normals from the points' neighborhoods
+	if (tstrips.empty() && (need_faces(), faces.empty())) {
+		need_point_normals();
 		return;
+	}
 
 	dprintf("Computing normals... ");
 	normals.clear();
@@ -216,21 +406,81 @@ void TriMesh::need_normals(bool simple_area_weighted /* = false */)
 			normals_from_tstrips_area(tstrips, vertices, normals);
 		else
 			normals_from_tstrips_Max(tstrips, vertices, normals);
-	} else if (need_faces(), !faces.empty()) {
+	} else {
 		if (simple_area_weighted)
 			normals_from_faces_area(faces, vertices, normals);
 		else
 			normals_from_faces_Max(faces, vertices, normals);
-	} else {
-		normals_from_points(vertices, normals);
 	}
 
 	// Make them all unit-length
-//#pragma omp parallel for
-	for (int i = 0; i < nv; i++)
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nv; i++)
 		normalize(normals[i]);
 
 	dprintf("Done.\n");
 }
 
+
+// Unit normals of the batch of faces starting at first
+static FACE_KERNEL void batch_facenormals(const vector<point> &vertices,
+	const vector<TriMesh::Face> &faces, ptrdiff_t first, vector<vec> &facenormals)
+{
+	FaceBatch fb;
+	fb.gather(vertices, faces, first);
+	FaceBatch::Lanes n[3];
+	fb.cross(1, 2, n);
+	FaceBatch::normalize(n);
+	for (int k = 0; k < fb.n; k++)
+		facenormals[first+k] = vec(n[0][k], n[1][k], n[2][k]);
+}
+
+
+// Compute per-face unit normals
+void TriMesh::need_facenormals()
+{
+	need_faces();
+	ptrdiff_t nf = faces.size();
+	if (ptrdiff_t(facenormals.size()) == nf)
+		return;
+
+	dprintf("Computing face normals... ");
+	facenormals.resize(nf);
+#pragma omp parallel for
+	for (ptrdiff_t first = 0; first < nf; first += FaceBatch::N)
+		batch_facenormals(vertices, faces, first, facenormals);
+	dprintf("Done.\n");
+}
+
+
+// Areas of the batch of faces starting at first
+static FACE_KERNEL void batch_faceareas(const vector<point> &vertices,
+	const vector<TriMesh::Face> &faces, ptrdiff_t first, vector<float> &faceareas)
+{
+	FaceBatch fb;
+	fb.gather(vertices, faces, first);
+	FaceBatch::Lanes n[3], l;
+	fb.cross(1, 2, n);
+	FaceBatch::length(n, l);
+	for (int k = 0; k < fb.n; k++)
+		faceareas[first+k] = 0.5f * l[k];
+}
+
+
+// Compute per-face areas
+void TriMesh::need_faceareas()
+{
+	need_faces();
+	ptrdiff_t nf = faces.size();
+	if (ptrdiff_t(faceareas.size()) == nf)
+		return;
+
+	dprintf("Computing face areas... ");
+	faceareas.resize(nf);
+#pragma omp parallel for
+	for (ptrdiff_t first = 0; first < nf; first += FaceBatch::N)
+		batch_faceareas(vertices, faces, first, faceareas);
+	dprintf("Done.\n");
+}
+
 } // namespace trimesh
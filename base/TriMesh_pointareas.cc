@@ -9,10 +9,29 @@ a vertex, or to the triangle).
 */
 
 #include "trimesh2/TriMesh.h"
+#include "trimesh2/VertexBlocks.h"
+#include "trimesh2/FaceKernels.h"
+using namespace std;
 
 
 namespace trimesh {
 
+// Corner areas of the batch of faces starting at first
+static FACE_KERNEL void batch_cornerareas(const vector<point> &vertices,
+	const vector<TriMesh::Face> &faces, ptrdiff_t first, vector<vec> &cornerareas)
+{
+	FaceBatch fb;
+	fb.gather(vertices, faces, first);
+	FaceBatch::Lanes ca[3];
+	fb.cornerareas(ca);
+	for (int k = 0; k < fb.n; k++) {
+		cornerareas[first+k][0] = ca[0][k];
+		cornerareas[first+k][1] = ca[1][k];
+		cornerareas[first+k][2] = ca[2][k];
+	}
+}
+
+
 // Compute per-vertex point areas
 void TriMesh::need_pointareas()
 {
@@ -22,61 +41,22 @@ void TriMesh::need_pointareas()
 
 	dprintf("Computing point areas... ");
 
-	int nf = faces.size(), nv = vertices.size();
+	ptrdiff_t nf = faces.size(), nv = vertices.size();
 	pointareas.clear();
 	pointareas.resize(nv);
 	cornerareas.clear();
 	cornerareas.resize(nf);
 
-//#pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		// Edges
-		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
-		             vertices[faces[i][0]] - vertices[faces[i][2]],
-		             vertices[faces[i][1]] - vertices[faces[i][0]] };
-
-		// Compute corner weights
-		float area = 0.5f * len(e[0] TRICROSS e[1]);
-		float l2[3] = { len2(e[0]), len2(e[1]), len2(e[2]) };
+	// Compute corner areas, a batch of faces at a time
+#pragma omp parallel for
+	for (ptrdiff_t first = 0; first < nf; first += FaceBatch::N)
+		batch_cornerareas(vertices, faces, first, cornerareas);
 
-		// Barycentric weights of circumcenter
-		float bcw[3] = { l2[0] * (l2[1] + l2[2] - l2[0]),
-		                 l2[1] * (l2[2] + l2[0] - l2[1]),
-		                 l2[2] * (l2[0] + l2[1] - l2[2]) };
-		if (bcw[0] <= 0.0f) {
-			cornerareas[i][1] = -0.25f * l2[2] * area /
-			                    (e[0] DOT e[2]);
-			cornerareas[i][2] = -0.25f * l2[1] * area /
-			                    (e[0] DOT e[1]);
-			cornerareas[i][0] = area - cornerareas[i][1] -
-			                    cornerareas[i][2];
-		} else if (bcw[1] <= 0.0f) {
-			cornerareas[i][2] = -0.25f * l2[0] * area /
-			                    (e[1] DOT e[0]);
-			cornerareas[i][0] = -0.25f * l2[2] * area /
-			                    (e[1] DOT e[2]);
-			cornerareas[i][1] = area - cornerareas[i][2] -
-			                    cornerareas[i][0];
-		} else if (bcw[2] <= 0.0f) {
-			cornerareas[i][0] = -0.25f * l2[1] * area /
-			                    (e[2] DOT e[1]);
-			cornerareas[i][1] = -0.25f * l2[0] * area /
-			                    (e[2] DOT e[0]);
-			cornerareas[i][2] = area - cornerareas[i][0] -
-			                    cornerareas[i][1];
-		} else {
-			float scale = 0.5f * area / (bcw[0] + bcw[1] + bcw[2]);
-			for (int j = 0; j < 3; j++)
-				cornerareas[i][j] = scale * (bcw[NEXT_MOD3(j)] +
-				                             bcw[PREV_MOD3(j)]);
-		}
-//#pragma omp atomic
-		pointareas[faces[i][0]] += cornerareas[i][0];
-//#pragma omp atomic
-		pointareas[faces[i][1]] += cornerareas[i][1];
-//#pragma omp atomic
-		pointareas[faces[i][2]] += cornerareas[i][2];
-	}
+	// Add up the corners at each vertex, in face order
+	VertexCorners vc(faces, nv);
+	vc.for_each([&](ptrdiff_t v, ptrdiff_t i, int j) {
+		pointareas[v] += cornerareas[i][j];
+	});
 
 	dprintf("Done.\n");
 }
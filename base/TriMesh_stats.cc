@@ -3,50 +3,64 @@ Szymon Rusinkiewicz
 Princeton University
 
 TriMesh_stats.cc
-Computation of various statistics on the mesh.
+Computation of various statistics on the mesh, and of its memory usage.
 */
 
 #include "trimesh2/TriMesh.h"
 #include "trimesh2/KDtree.h"
-#include <numeric>
+#include "trimesh2/FaceKernels.h"
+#include <algorithm>
 using namespace std;
 
 
 namespace trimesh {
 
+// Corner angles of the batch of faces starting at first
+static FACE_KERNEL void batch_angles(const vector<point> &vertices,
+	const vector<TriMesh::Face> &faces, ptrdiff_t first, vector<float> &angles)
+{
+	FaceBatch fb;
+	fb.gather(vertices, faces, first);
+	FaceBatch::Lanes ang[3];
+	fb.angles(ang);
+	for (int k = 0; k < fb.n; k++)
+		for (int j = 0; j < 3; j++)
+			angles[3*(first+k)+j] = ang[j][k];
+}
+
+
 // Compute a variety of statistics.  Takes a type of statistic to compute,
-// and what to do with it.
-float TriMesh::stat(StatOp op, StatVal val)
+// what to do with it, and how to add things up.
+float TriMesh::stat(StatOp op, StatVal val, SumMode mode /* = SUM_DOUBLE */)
 {
 	vector<float> vals;
 
 	switch (val) {
 		case STAT_VALENCE: {
 			need_neighbors();
-			int nv = vertices.size();
-			for (int i = 0; i < nv; i++)
+			ptrdiff_t nv = vertices.size();
+			for (ptrdiff_t i = 0; i < nv; i++)
 				vals.push_back((float) neighbors[i].size());
 			break;
 		}
 		case STAT_FACEAREA: {
-			need_faces();
-			int nf = faces.size();
-			for (int i = 0; i < nf; i++)
-				vals.push_back(len(trinorm(i)));
+			need_faceareas();
+			vals = faceareas;
 			break;
 		}
 		case STAT_ANGLE: {
 			need_faces();
-			int nf = faces.size();
-			for (int i = 0; i < nf; i++)
-				for (int j = 0; j < 3; j++)
-					vals.push_back(cornerangle(i, j));
+			ptrdiff_t nf = faces.size();
+			vals.resize(3 * nf);
+#pragma omp parallel for
+			for (ptrdiff_t first = 0; first < nf; first += FaceBatch::N)
+				batch_angles(vertices, faces, first, vals);
 			break;
 		}
 		case STAT_DIHEDRAL: {
 			need_across_edge();
-			int nf = faces.size();
-			for (int i = 0; i < nf; i++)
+			ptrdiff_t nf = faces.size();
+			for (ptrdiff_t i = 0; i < nf; i++)
 				for (int j = 0; j < 3; j++) {
 					if (across_edge[i][j] < 0)
 						continue;
@@ -55,30 +69,28 @@ float TriMesh::stat(StatOp op, StatVal val)
 			break;
 		}
 		case STAT_EDGELEN: {
-			need_faces();
-			int nf = faces.size();
-			for (int i = 0; i < nf; i++)
-				for (int j = 0; j < 3; j++)
-					vals.push_back(dist(
-						vertices[faces[i][j]],
-						vertices[faces[i][NEXT_MOD3(j)]]));
+			need_edges();
+			ptrdiff_t ne = edges.size();
+			for (ptrdiff_t i = 0; i < ne; i++)
+				vals.push_back(dist(vertices[edges[i][0]],
+				                    vertices[edges[i][1]]));
 			break;
 		}
 		case STAT_X: {
-			int nv = vertices.size();
-			for (int i = 0; i < nv; i++)
+			ptrdiff_t nv = vertices.size();
+			for (ptrdiff_t i = 0; i < nv; i++)
 				vals.push_back(vertices[i][0]);
 			break;
 		}
 		case STAT_Y: {
-			int nv = vertices.size();
-			for (int i = 0; i < nv; i++)
+			ptrdiff_t nv = vertices.size();
+			for (ptrdiff_t i = 0; i < nv; i++)
 				vals.push_back(vertices[i][1]);
 			break;
 		}
 		case STAT_Z: {
-			int nv = vertices.size();
-			for (int i = 0; i < nv; i++)
+			ptrdiff_t nv = vertices.size();
+			for (ptrdiff_t i = 0; i < nv; i++)
 				vals.push_back(vertices[i][2]);
 			break;
 		}
@@ -86,7 +98,7 @@ float TriMesh::stat(StatOp op, StatVal val)
 			return 0.0f;
 	}
 
-	int n = vals.size();
+	ptrdiff_t n = vals.size();
 	if (!n)
 		return 0.0f;
 
@@ -96,7 +108,7 @@ float TriMesh::stat(StatOp op, StatVal val)
 		case STAT_MAXABS:
 		case STAT_SUMABS:
 		case STAT_MEANABS:
-			for (int i = 0; i < n; i++) {
+			for (ptrdiff_t i = 0; i < n; i++) {
 				if (vals[i] < 0.0f)
 					vals[i] = -vals[i];
 			}
@@ -104,7 +116,7 @@ float TriMesh::stat(StatOp op, StatVal val)
 
 		case STAT_SUMSQR:
 		case STAT_RMS:
-			for (int i = 0; i < n; i++)
+			for (ptrdiff_t i = 0; i < n; i++)
 				vals[i] *= vals[i];
 			break;
 
@@ -113,6 +125,10 @@ float TriMesh::stat(StatOp op, StatVal val)
 	}
 
 	// Now do the computation
+	auto sum = [&]() {
+		return parallel_sum<float>(mode, n,
+			[&](size_t i) { return vals[i]; });
+	};
 	switch (op) {
 		case STAT_MIN:
 		case STAT_MINABS:
@@ -125,15 +141,14 @@ float TriMesh::stat(StatOp op, StatVal val)
 		case STAT_SUM:
 		case STAT_SUMABS:
 		case STAT_SUMSQR:
-			return accumulate(vals.begin(), vals.end(), 0.0f);
+			return sum();
 
 		case STAT_MEAN:
 		case STAT_MEANABS:
-			return accumulate(vals.begin(), vals.end(), 0.0f) / n;
+			return sum() / n;
 
 		case STAT_RMS:
-			return sqrt(accumulate(vals.begin(), vals.end(), 0.0f)
-				/ n);
+			return sqrt(sum() / n);
 
 		case STAT_MEDIAN:
 			if (n & 1) {
@@ -153,12 +168,11 @@ float TriMesh::stat(StatOp op, StatVal val)
 			}
 
 		case STAT_STDEV: {
-			float mean = accumulate(vals.begin(), vals.end(), 0.0f)
-				/ n;
-			for (int i = 0; i < n; i++)
+			float mean = sum() / n;
+#pragma omp parallel for
+			for (ptrdiff_t i = 0; i < n; i++)
 				vals[i] = sqr(vals[i] - mean);
-			return sqrt(accumulate(vals.begin(), vals.end(), 0.0f)
-				/ n);
+			return sqrt(sum() / n);
 		}
 
 		default:
@@ -174,9 +188,9 @@ float TriMesh::feature_size()
 {
 	const int nsamples = 999;
 	const float approx_eps = 0.05f;
-	int nv = vertices.size();
+	ptrdiff_t nv = vertices.size();
 	need_faces();
-	int nf = faces.size();
+	ptrdiff_t nf = faces.size();
 
 	vector<float> samples;
 	samples.reserve(nsamples);
@@ -198,15 +212,12 @@ float TriMesh::feature_size()
 			samples.push_back(dist2(p2,p0));
 		}
 	} else if (nf > 0) {
-		// Small mesh - just loop over all faces
-		for (int ind = 0; ind < nf; ind++) {
-			const point &p0 = vertices[faces[ind][0]];
-			const point &p1 = vertices[faces[ind][1]];
-			const point &p2 = vertices[faces[ind][2]];
-			samples.push_back(dist2(p0,p1));
-			samples.push_back(dist2(p1,p2));
-			samples.push_back(dist2(p2,p0));
-		}
+		// Small mesh - just loop over all edges
+		need_edges();
+		ptrdiff_t ne = edges.size();
+		for (ptrdiff_t ind = 0; ind < ne; ind++)
+			samples.push_back(dist2(vertices[edges[ind][0]],
+			                        vertices[edges[ind][1]]));
 	} else if (nv > nsamples) {
 		// Big point cloud - do sampling
 		KDtree kd(vertices);
@@ -219,7 +230,7 @@ float TriMesh::feature_size()
 	} else {
 		// Small point cloud - just loop over all vertices
 		KDtree kd(vertices);
-		for (int ind = 0; ind < nv; ind++) {
+		for (ptrdiff_t ind = 0; ind < nv; ind++) {
 			const point &p = vertices[ind];
 			const float *q = kd.closest_to_pt(p, 0.0f, approx_eps);
 			samples.push_back(dist2(p, point(q)));
@@ -233,4 +244,75 @@ float TriMesh::feature_size()
 	return sqrt(samples[samples.size()/2]);
 }
 
+
+// Memory allocated by a vector
+template <class T>
+static inline size_t allocated(const vector<T> &v)
+{
+	return v.capacity() * sizeof(T);
+}
+
+static inline size_t allocated(const Adjacency &a)
+{
+	return allocated(a.offsets) + allocated(a.indices);
+}
+
+
+// Find the memory used by the mesh, in bytes, counting allocated (not
+// just used) storage of each member.
+size_t TriMesh::memory_usage(vector<MemoryItem> *breakdown) const
+{
+	vector<MemoryItem> items;
+#define MEMBER(m) items.push_back(MemoryItem(#m, allocated(m)))
+	MEMBER(vertices); MEMBER(faces);
+	MEMBER(UVs); MEMBER(faceUVs);
+	MEMBER(tstrips); MEMBER(grid);
+	MEMBER(colors); MEMBER(confidences); MEMBER(flags);
+	MEMBER(normals);
+	MEMBER(pdir1); MEMBER(pdir2); MEMBER(curv1); MEMBER(curv2);
+	MEMBER(dcurv);
+	MEMBER(cornerareas); MEMBER(pointareas);
+	MEMBER(facenormals); MEMBER(faceareas);
+	MEMBER(neighbors); MEMBER(adjacentfaces);
+	MEMBER(across_edge); MEMBER(edges); MEMBER(faceedges);
+	MEMBER(boundary_loops);
+#undef MEMBER
+
+	size_t total = sizeof(*this);
+	if (breakdown)
+		breakdown->clear();
+	for (size_t i = 0; i < items.size(); i++) {
+		if (!items[i].second)
+			continue;
+		total += items[i].second;
+		if (breakdown)
+			breakdown->push_back(items[i]);
+	}
+	return total;
+}
+
+
+// Release memory allocated beyond what each member needs
+void TriMesh::shrink_to_fit()
+{
+	vertices.shrink_to_fit(); faces.shrink_to_fit();
+	UVs.shrink_to_fit(); faceUVs.shrink_to_fit();
+	tstrips.shrink_to_fit(); grid.shrink_to_fit();
+	colors.shrink_to_fit(); confidences.shrink_to_fit();
+	flags.shrink_to_fit();
+	normals.shrink_to_fit();
+	pdir1.shrink_to_fit(); pdir2.shrink_to_fit();
+	curv1.shrink_to_fit(); curv2.shrink_to_fit();
+	dcurv.shrink_to_fit();
+	cornerareas.shrink_to_fit(); pointareas.shrink_to_fit();
+	facenormals.shrink_to_fit(); faceareas.shrink_to_fit();
+	neighbors.offsets.shrink_to_fit(); neighbors.indices.shrink_to_fit();
+	adjacentfaces.offsets.shrink_to_fit();
+	adjacentfaces.indices.shrink_to_fit();
+	across_edge.shrink_to_fit();
+	edges.shrink_to_fit(); faceedges.shrink_to_fit();
+	boundary_loops.offsets.shrink_to_fit();
+	boundary_loops.indices.shrink_to_fit();
+}
+
 } // namespace trimesh
@@ -35,11 +35,11 @@ void TriMesh::need_tstrips(TstripRep rep)
 	need_across_edge();
 
 	dprintf("Building triangle strips... ");
-	int nf = faces.size();
+	ptrdiff_t nf = faces.size();
 
 	vector<int> todo;
 	vector<signed char> face_avail(nf);
-	for (int i = 0; i < nf; i++) {
+	for (ptrdiff_t i = 0; i < nf; i++) {
 		face_avail[i] = (across_edge[i][0] != -1) +
 				(across_edge[i][1] != -1) +
 				(across_edge[i][2] != -1);
@@ -151,9 +151,9 @@ void TriMesh::unpack_tstrips()
 	convert_strips(TSTRIP_LENGTH);
 
 	dprintf("Unpacking triangle strips... ");
-	int nstrips = tstrips.size();
-	int nfaces = 0;
-	int i = 0;
+	ptrdiff_t nstrips = tstrips.size();
+	size_t nfaces = 0;
+	ptrdiff_t i = 0;
 	while (i < nstrips) {
 		nfaces += tstrips[i] - 2;
 		i += tstrips[i] + 1;
@@ -181,7 +181,7 @@ void TriMesh::unpack_tstrips()
 		flip = !flip;
 		len--;
 	}
-	dprintf("Done.\n  %d triangles\n", nfaces);
+	dprintf("Done.\n  %lu triangles\n", (unsigned long) nfaces);
 }
 
 
@@ -197,7 +197,7 @@ void TriMesh::convert_strips(TstripRep rep)
 		//collect_tris_in_strips(tstrips);
 		return;
 	}
-	int nstrips = tstrips.size();
+	ptrdiff_t nstrips = tstrips.size();
 
 	if (rep == TSTRIP_TERM) {
 		int len = tstrips[0];
@@ -235,11 +235,11 @@ static void collect_tris_in_strips(vector<int> &tstrips)
 	if (tstrips.empty())
 		return;
 	vector<int> tris;
-	int nstrips = tstrips.size();
+	ptrdiff_t nstrips = tstrips.size();
 
 	int n = 0, offset = 0;
 	bool have_tri = false, bad_strip = false;
-	for (int i = 0; i < nstrips; i++) {
+	for (ptrdiff_t i = 0; i < nstrips; i++) {
 		if (n == 0) {
 			n = tstrips[i];
 			bad_strip = (n < 3);
@@ -7,18 +7,14 @@ Determine the connected components of a mesh, and perform some basic
 manipulations on them.  utilsrc/mesh_cc is a front-end for this code.
 */
 
-#include "TriMesh.h"
-#include "TriMesh_algo.h"
+#include "trimesh2/TriMesh.h"
+#include "trimesh2/TriMesh_algo.h"
 #include <stack>
+#include <algorithm>
 using namespace std;
 
 
 #define NO_COMP -1
-#define FOR_EACH_ADJACENT_FACE(mesh,v,f) \
-	for (size_t f_ind = 0, f = mesh->adjacentfaces[v][0]; \
-	     (f_ind < mesh->adjacentfaces[v].size()) && \
-	     ((f = mesh->adjacentfaces[v][f_ind]) || 1); \
-	     f_ind++)
 
 
 namespace trimesh {
@@ -72,7 +68,7 @@ static void find_connected(const TriMesh *mesh,
 		s.pop();
 		for (int i = 0; i < 3; i++) {
 			int vert = mesh->faces[currface][i];
-			FOR_EACH_ADJACENT_FACE(mesh, vert, adjface) {
+			for (int adjface : mesh->adjacentfaces[vert]) {
 				if (comps[adjface] != NO_COMP ||
 				    !connected(mesh, adjface, currface, conn_vert))
 					continue;
@@ -128,13 +124,13 @@ void find_comps(TriMesh *mesh, vector<int> &comps, vector<int> &compsizes,
 		return;
 	mesh->need_adjacentfaces();
 
-	int nf = mesh->faces.size();
+	ptrdiff_t nf = mesh->faces.size();
 	comps.clear();
 	comps.reserve(nf);
 	comps.resize(nf, NO_COMP);
 	compsizes.clear();
 
-	for (int i = 0; i < nf; i++) {
+	for (ptrdiff_t i = 0; i < nf; i++) {
 		if (comps[i] != NO_COMP)
 			continue;
 		int comp = compsizes.size();
@@ -152,9 +148,9 @@ void find_comps(TriMesh *mesh, vector<int> &comps, vector<int> &compsizes,
 // the mesh.
 void select_comp(TriMesh *mesh, const vector<int> &comps, int whichcc)
 {
-	int numfaces = mesh->faces.size();
+	ptrdiff_t numfaces = mesh->faces.size();
 	vector<bool> toremove(numfaces, false);
-	for (int i = 0; i < numfaces; i++) {
+	for (ptrdiff_t i = 0; i < numfaces; i++) {
 		if (comps[i] != whichcc)
 			toremove[i] = true;
 	}
@@ -177,9 +173,9 @@ void select_big_comps(TriMesh *mesh,
 	while (keep_last > -1 && compsizes[keep_last] < min_size)
 		keep_last--;
 
-	int numfaces = mesh->faces.size();
+	ptrdiff_t numfaces = mesh->faces.size();
 	vector<bool> toremove(numfaces, false);
-	for (int i = 0; i < numfaces; i++) {
+	for (ptrdiff_t i = 0; i < numfaces; i++) {
 		if (comps[i] > keep_last)
 			toremove[i] = true;
 	}
@@ -201,9 +197,9 @@ void select_small_comps(TriMesh *mesh,
 	while (keep_first < ncomp && compsizes[keep_first] > max_size)
 		keep_first++;
 
-	int numfaces = mesh->faces.size();
+	ptrdiff_t numfaces = mesh->faces.size();
 	vector<bool> toremove(numfaces, false);
-	for (int i = 0; i < numfaces; i++) {
+	for (ptrdiff_t i = 0; i < numfaces; i++) {
 		if (comps[i] < keep_first)
 			toremove[i] = true;
 	}
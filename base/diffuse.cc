@@ -6,9 +6,10 @@ diffuse.cc
 Smoothing of meshes and per-vertex fields
 */
 
-#include "TriMesh.h"
-#include "TriMesh_algo.h"
-#include "timestamp.h"
+#include "trimesh2/TriMesh.h"
+#include "trimesh2/TriMesh_algo.h"
+#include "trimesh2/VertexBlocks.h"
+#include "trimesh2/timestamp.h"
 using namespace std;
 #define dprintf TriMesh::dprintf
 
@@ -134,8 +135,7 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 {
 	themesh->need_faces();
 	diffuse_normals(themesh, 0.5f * sigma);
-	int nv = themesh->vertices.size();
-	int nf = themesh->faces.size();
+	ptrdiff_t nv = themesh->vertices.size();
 
 	dprintf("\rSmoothing... ");
 	timestamp t = now();
@@ -151,33 +151,38 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 
 		// Main filtering step
 #pragma omp for
-		for (int i = 0; i < nv; i++) {
+		for (ptrdiff_t i = 0; i < nv; i++) {
 			diffuse_vert_field(themesh, flags, flag_curr,
 				AccumVec<vec>(themesh->vertices),
 				i, invsigma2, dflt[i]);
 			// Just keep the displacement
 			dflt[i] -= themesh->vertices[i];
 		}
+	} // #pragma omp parallel
 
-		// Slightly better small-neighborhood approximation
-#pragma omp for
-		for (int i = 0; i < nf; i++) {
-			point c = (themesh->vertices[themesh->faces[i][0]] +
-			           themesh->vertices[themesh->faces[i][1]] +
-			           themesh->vertices[themesh->faces[i][2]])
-				* (1.0f / 3.0f);
-			for (int j = 0; j < 3; j++) {
-				int v = themesh->faces[i][j];
-				vec d = 0.5f * (c - themesh->vertices[v]);
-				dflt[v] += themesh->cornerareas[i][j] /
-				           themesh->pointareas[themesh->faces[i][j]] *
-				           exp(-0.5f * invsigma2 * len2(d)) * d;
-			}
-		}
+	// Slightly better small-neighborhood approximation.  Each vertex is
+	// updated by only one thread (see VertexBlocks.h).
+	VertexCorners vc(themesh->faces, nv);
+	vc.for_each([&](ptrdiff_t v, ptrdiff_t i, int j) {
+		point c = (themesh->vertices[themesh->faces[i][0]] +
+		           themesh->vertices[themesh->faces[i][1]] +
+		           themesh->vertices[themesh->faces[i][2]])
+			* (1.0f / 3.0f);
+		vec d = 0.5f * (c - themesh->vertices[v]);
+		dflt[v] += themesh->cornerareas[i][j] /
+		           themesh->pointareas[v] *
+		           exp(-0.5f * invsigma2 * len2(d)) * d;
+	});
+
+#pragma omp parallel
+	{
+		// Thread-local flags
+		vector<unsigned> flags(nv);
+		unsigned flag_curr = 0;
 
 		// Filter displacement field
 #pragma omp for
-		for (int i = 0; i < nv; i++) {
+		for (ptrdiff_t i = 0; i < nv; i++) {
 			diffuse_vert_field(themesh, flags, flag_curr,
 				AccumVec<point>(dflt),
 				i, invsigma2, dflt2[i]);
@@ -185,10 +190,11 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 
 		// Update vertex positions
 #pragma omp for
-		for (int i = 0; i < nv; i++)
+		for (ptrdiff_t i = 0; i < nv; i++)
 			themesh->vertices[i] += dflt[i] - dflt2[i]; // second Laplacian
 	} // #pragma omp parallel
 
+	themesh->changed_geometry();
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
 
@@ -248,7 +254,7 @@ void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2)
 	themesh->need_normals();
 	themesh->need_pointareas();
 	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
+	ptrdiff_t nv = themesh->vertices.size();
 
 	diffuse_normals(themesh, 0.5f * sigma1);
 
@@ -266,13 +272,13 @@ void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2)
 		unsigned flag_curr = 0;
 
 #pragma omp for
-		for (int i = 0; i < nv; i++)
+		for (ptrdiff_t i = 0; i < nv; i++)
 			jones_filter(themesh, flags, flag_curr,
 				i, invsigma2_1, invsigma2_2, oldverts);
 	}
 
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
-	themesh->normals.clear();
+	themesh->changed_geometry();
 	if (had_normals)
 		themesh->need_normals();
 }
@@ -285,7 +291,7 @@ void diffuse_vector(TriMesh *themesh, std::vector<T> &field, float sigma)
 	themesh->need_normals();
 	themesh->need_pointareas();
 	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
+	ptrdiff_t nv = themesh->vertices.size();
 
 	dprintf("\rSmoothing vector field... ");
 	timestamp t = now();
@@ -301,7 +307,7 @@ void diffuse_vector(TriMesh *themesh, std::vector<T> &field, float sigma)
 		unsigned flag_curr = 0;
 
 #pragma omp for
-		for (int i = 0; i < nv; i++)
+		for (ptrdiff_t i = 0; i < nv; i++)
 			diffuse_vert_field(themesh, flags, flag_curr,
 				a, i, invsigma2, flt[i]);
 	} // #pragma omp parallel
@@ -318,7 +324,7 @@ void diffuse_normals(TriMesh *themesh, float sigma)
 	themesh->need_normals();
 	themesh->need_pointareas();
 	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
+	ptrdiff_t nv = themesh->vertices.size();
 
 	dprintf("\rSmoothing normals... ");
 	timestamp t = now();
@@ -334,7 +340,7 @@ void diffuse_normals(TriMesh *themesh, float sigma)
 		unsigned flag_curr = 0;
 
 #pragma omp for
-		for (int i = 0; i < nv; i++) {
+		for (ptrdiff_t i = 0; i < nv; i++) {
 			diffuse_vert_field(themesh, flags, flag_curr,
 				a, i, invsigma2, nflt[i]);
 			normalize(nflt[i]);
@@ -354,7 +360,7 @@ void diffuse_curv(TriMesh *themesh, float sigma)
 	themesh->need_pointareas();
 	themesh->need_curvatures();
 	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
+	ptrdiff_t nv = themesh->vertices.size();
 
 	dprintf("\rSmoothing curvatures... ");
 	timestamp t = now();
@@ -369,12 +375,12 @@ void diffuse_curv(TriMesh *themesh, float sigma)
 		unsigned flag_curr = 0;
 
 #pragma omp for
-		for (int i = 0; i < nv; i++)
+		for (ptrdiff_t i = 0; i < nv; i++)
 			diffuse_vert_field(themesh, flags, flag_curr,
 				AccumCurv(), i, invsigma2, cflt[i]);
 
 #pragma omp for
-		for (int i = 0; i < nv; i++)
+		for (ptrdiff_t i = 0; i < nv; i++)
 			diagonalize_curv(themesh->pdir1[i], themesh->pdir2[i],
 			                 cflt[i][0], cflt[i][1], cflt[i][2],
 			                 themesh->normals[i],
@@ -394,7 +400,7 @@ void diffuse_dcurv(TriMesh *themesh, float sigma)
 	themesh->need_curvatures();
 	themesh->need_dcurv();
 	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
+	ptrdiff_t nv = themesh->vertices.size();
 
 	dprintf("\rSmoothing curvature derivatives... ");
 	timestamp t = now();
@@ -409,7 +415,7 @@ void diffuse_dcurv(TriMesh *themesh, float sigma)
 		unsigned flag_curr = 0;
 
 #pragma omp for
-		for (int i = 0; i < nv; i++)
+		for (ptrdiff_t i = 0; i < nv; i++)
 			diffuse_vert_field(themesh, flags, flag_curr,
 				AccumDCurv(), i, invsigma2, dflt[i]);
 	} // #pragma omp parallel
@@ -0,0 +1,330 @@
+/*
+features.cc
+Extraction of feature lines (ridges, valleys, and sharp creases) as
+polylines.
+
+Ridges and valleys follow
+ Ohtake, Y., Belyaev, A., and Seidel, H.-P.
+ "Ridge-Valley Lines on Meshes via Implicit Surface Fitting,"
+ Proc. SIGGRAPH, 2004.
+using the curvature derivatives from need_dcurv().  Each face is handled
+independently (and in parallel), producing line segments whose endpoints
+lie on mesh edges, which are then joined into polylines.
+*/
+
+#include "trimesh2/TriMesh.h"
+#include "trimesh2/TriMesh_algo.h"
+#include <algorithm>
+using namespace std;
+#define dprintf TriMesh::dprintf
+
+
+namespace trimesh {
+
+// A line segment, with a key identifying each endpoint so that segments
+// from neighboring faces can be joined up.  Points on edges are keyed by
+// the edge's vertices, lower-numbered first; points at vertices (for
+// creases) by the vertex; and points at face centers by the face.
+struct FeatureSegment {
+	uint64_t key[2];
+	point p[2];
+};
+
+static inline uint64_t edge_key(int v1, int v2)
+{
+	if (v1 > v2)
+		swap(v1, v2);
+	return (uint64_t(v1) << 32) | uint64_t(unsigned(v2));
+}
+
+static inline uint64_t vert_key(int v)
+{
+	return uint64_t(unsigned(v));
+}
+
+static inline uint64_t center_key(int f)
+{
+	return (uint64_t(1) << 63) | uint64_t(unsigned(f));
+}
+
+
+// Join segments that share endpoints into polylines.  Chains stop at
+// points shared by other than two segments.  Closed loops repeat their
+// first point at the end.
+static void chain_segments(const vector<FeatureSegment> &segs,
+                           vector<FeatureLine> &lines)
+{
+	lines.clear();
+	size_t nsegs = segs.size();
+	if (!nsegs)
+		return;
+
+	// Sort the segment ends by key, so that the ends meeting at each
+	// point are together
+	vector< pair<uint64_t, size_t> > ends(2 * nsegs);
+	for (size_t i = 0; i < nsegs; i++) {
+		ends[2*i]   = make_pair(segs[i].key[0], 2*i);
+		ends[2*i+1] = make_pair(segs[i].key[1], 2*i+1);
+	}
+	sort(ends.begin(), ends.end());
+
+	// For each segment end, where its point's run of ends begins, and
+	// how many there are
+	vector<size_t> run_start(2 * nsegs), run_len(2 * nsegs);
+	for (size_t i = 0; i < 2 * nsegs; ) {
+		size_t j = i + 1;
+		while (j < 2 * nsegs && ends[j].first == ends[i].first)
+			j++;
+		for (size_t k = i; k < j; k++) {
+			run_start[ends[k].second] = i;
+			run_len[ends[k].second] = j - i;
+		}
+		i = j;
+	}
+
+	// Given one end of a segment, the end of the other segment that
+	// meets it, or -1 if the chain stops there
+	auto continue_from = [&](size_t end) -> ptrdiff_t {
+		if (run_len[end] != 2)
+			return -1;
+		size_t s = run_start[end];
+		return (ends[s].second == end) ? ends[s+1].second :
+		                                 ends[s].second;
+	};
+
+	vector<bool> used(nsegs);
+	auto trace = [&](size_t start_end) {
+		FeatureLine line;
+		size_t end = start_end;
+		line.push_back(segs[end/2].p[end & 1]);
+		while (true) {
+			used[end/2] = true;
+			size_t far_end = end ^ 1;
+			line.push_back(segs[far_end/2].p[far_end & 1]);
+			ptrdiff_t next = continue_from(far_end);
+			if (next < 0 || used[next/2])
+				break;
+			end = next;
+		}
+		lines.push_back(line);
+	};
+
+	// Open chains, starting from their ends
+	for (size_t i = 0; i < 2 * nsegs; i++) {
+		if (!used[i/2] && run_len[i] != 2)
+			trace(i);
+	}
+
+	// Whatever is left is closed loops
+	for (size_t i = 0; i < nsegs; i++) {
+		if (!used[i])
+			trace(2 * i);
+	}
+}
+
+
+// The point where a ridge crosses the edge from v0 to v1, interpolating
+// by the curvature derivatives e0 and e1 at the endpoints, and the
+// magnitude of the curvature there.  The same point is computed for
+// either direction along the edge.
+static inline void ridge_point(const TriMesh *mesh, int v0, int v1,
+                               float e0, float e1, point &p, float &k)
+{
+	if (v0 > v1) {
+		swap(v0, v1);
+		swap(e0, e1);
+	}
+	// If both derivatives are zero, the whole edge is flat: use the
+	// midpoint
+	float denom = fabs(e0) + fabs(e1);
+	float w1 = (denom > 0.0f) ? fabs(e0) / denom : 0.5f;
+	float w0 = 1.0f - w1;
+	p = w0 * mesh->vertices[v0] + w1 * mesh->vertices[v1];
+	k = fabs(w0 * mesh->curv1[v0] + w1 * mesh->curv1[v1]);
+}
+
+
+// Find the ridge (or valley) segments in face f, as in rtsc.  Returns
+// the number of segments (0 to 3) put into segs.
+static int face_ridges(const TriMesh *mesh, int f, bool valleys,
+                       float thresh, FeatureSegment *segs)
+{
+	const TriMesh::Face &face = mesh->faces[f];
+	int v[3] = { face[0], face[1], face[2] };
+
+	// Ridges are where the larger-magnitude curvature is positive, and
+	// valleys where it is negative
+	float rv_sign = valleys ? -1.0f : 1.0f;
+	for (int j = 0; j < 3; j++) {
+		if (rv_sign * mesh->curv1[v[j]] <= 0.0f)
+			return 0;
+	}
+
+	// The principal directions of maximum curvature, flipped to point
+	// in the direction in which the curvature is increasing (or
+	// decreasing, for valleys)
+	float e[3];
+	vec tmax[3];
+	for (int j = 0; j < 3; j++) {
+		e[j] = mesh->dcurv[v[j]][0];
+		tmax[j] = rv_sign * e[j] * mesh->pdir1[v[j]];
+	}
+
+	// There is a zero crossing on an edge if the tmax at its ends point
+	// in opposite directions.  z[j] is for the edge opposite corner j.
+	bool z[3];
+	for (int j = 0; j < 3; j++)
+		z[j] = (tmax[NEXT_MOD3(j)] DOT tmax[PREV_MOD3(j)]) <= 0.0f;
+	if (z[0] + z[1] + z[2] < 2)
+		return 0;
+
+	// Check that it is a maximum (or minimum) and not the other kind of
+	// extremum: the curvature should increase toward the crossing
+	for (int j = 0; j < 3; j++) {
+		int j0 = NEXT_MOD3(j), j1 = PREV_MOD3(j);
+		vec d = mesh->vertices[v[j1]] - mesh->vertices[v[j0]];
+		z[j] = z[j] && ((tmax[j0] DOT d) >= 0.0f ||
+		                (tmax[j1] DOT d) <= 0.0f);
+	}
+	if (z[0] + z[1] + z[2] < 2)
+		return 0;
+
+	// Crossing points on the edges
+	point p[3];
+	float k[3];
+	for (int j = 0; j < 3; j++) {
+		if (z[j])
+			ridge_point(mesh, v[NEXT_MOD3(j)], v[PREV_MOD3(j)],
+			            e[NEXT_MOD3(j)], e[PREV_MOD3(j)], p[j], k[j]);
+	}
+
+	int nsegs = 0;
+	if (z[0] && z[1] && z[2]) {
+		// All three edges have crossings: connect them to the center
+		point c = (mesh->vertices[v[0]] + mesh->vertices[v[1]] +
+		           mesh->vertices[v[2]]) / 3.0f;
+		float kc = fabs(mesh->curv1[v[0]] + mesh->curv1[v[1]] +
+		                mesh->curv1[v[2]]) / 3.0f;
+		for (int j = 0; j < 3; j++) {
+			if (k[j] < thresh && kc < thresh)
+				continue;
+			FeatureSegment &s = segs[nsegs++];
+			s.key[0] = edge_key(v[NEXT_MOD3(j)], v[PREV_MOD3(j)]);
+			s.key[1] = center_key(f);
+			s.p[0] = p[j];
+			s.p[1] = c;
+		}
+	} else {
+		// Exactly two edges have crossings: connect them
+		int j0 = !z[0] ? 1 : 0, j1 = !z[2] ? 1 : 2;
+		if (k[j0] < thresh && k[j1] < thresh)
+			return 0;
+		FeatureSegment &s = segs[nsegs++];
+		s.key[0] = edge_key(v[NEXT_MOD3(j0)], v[PREV_MOD3(j0)]);
+		s.key[1] = edge_key(v[NEXT_MOD3(j1)], v[PREV_MOD3(j1)]);
+		s.p[0] = p[j0];
+		s.p[1] = p[j1];
+	}
+	return nsegs;
+}
+
+
+// Find ridge or valley lines
+void find_ridges(TriMesh *mesh, bool valleys, float thresh,
+                 vector<FeatureLine> &lines)
+{
+	mesh->need_faces();
+	mesh->need_curvatures();
+	mesh->need_dcurv();
+
+	dprintf("Finding %s... ", valleys ? "valleys" : "ridges");
+	ptrdiff_t nf = mesh->faces.size();
+	vector<FeatureSegment> facesegs(3 * nf);
+	vector<unsigned char> nfacesegs(nf);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nf; i++)
+		nfacesegs[i] = face_ridges(mesh, i, valleys, thresh,
+		                           &facesegs[3*i]);
+
+	vector<FeatureSegment> segs;
+	for (ptrdiff_t i = 0; i < nf; i++)
+		segs.insert(segs.end(), facesegs.begin() + 3*i,
+		            facesegs.begin() + 3*i + nfacesegs[i]);
+	chain_segments(segs, lines);
+	dprintf("%lu lines from %lu segments.\n",
+		(unsigned long) lines.size(), (unsigned long) segs.size());
+}
+
+
+// Find ridges or valleys after smoothing the curvatures at each scale
+void find_ridges_multiscale(TriMesh *mesh, bool valleys, float thresh,
+                            const vector<float> &sigmas,
+                            vector< vector<FeatureLine> > &lines)
+{
+	mesh->need_curvatures();
+	vector<vec> pdir1 = mesh->pdir1, pdir2 = mesh->pdir2;
+	vector<float> curv1 = mesh->curv1, curv2 = mesh->curv2;
+
+	lines.clear();
+	lines.resize(sigmas.size());
+	for (size_t s = 0; s < sigmas.size(); s++) {
+		mesh->pdir1 = pdir1; mesh->pdir2 = pdir2;
+		mesh->curv1 = curv1; mesh->curv2 = curv2;
+		mesh->clear_dcurv();
+		if (sigmas[s] > 0.0f) {
+			diffuse_curv(mesh, sigmas[s]);
+			mesh->need_dcurv();
+			diffuse_dcurv(mesh, sigmas[s]);
+		}
+		find_ridges(mesh, valleys, thresh, lines[s]);
+	}
+
+	// Leave the unsmoothed curvatures behind
+	mesh->pdir1.swap(pdir1); mesh->pdir2.swap(pdir2);
+	mesh->curv1.swap(curv1); mesh->curv2.swap(curv2);
+	mesh->clear_dcurv();
+}
+
+
+// Find sharp creases
+void find_creases(TriMesh *mesh, float angle, vector<FeatureLine> &lines)
+{
+	mesh->need_faces();
+	mesh->need_across_edge();
+	mesh->need_facenormals();
+
+	dprintf("Finding creases... ");
+	ptrdiff_t nf = mesh->faces.size();
+	float cosangle = cos(angle);
+	vector<unsigned char> sharp(nf);
+#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			int f = mesh->across_edge[i][j];
+			if (f > i && (mesh->facenormals[i] DOT
+			              mesh->facenormals[f]) < cosangle)
+				sharp[i] |= 1u << j;
+		}
+	}
+
+	vector<FeatureSegment> segs;
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			if (!(sharp[i] & (1u << j)))
+				continue;
+			int v0 = mesh->faces[i][NEXT_MOD3(j)];
+			int v1 = mesh->faces[i][PREV_MOD3(j)];
+			FeatureSegment s;
+			s.key[0] = vert_key(v0);
+			s.key[1] = vert_key(v1);
+			s.p[0] = mesh->vertices[v0];
+			s.p[1] = mesh->vertices[v1];
+			segs.push_back(s);
+		}
+	}
+	chain_segments(segs, lines);
+	dprintf("%lu lines from %lu edges.\n",
+		(unsigned long) lines.size(), (unsigned long) segs.size());
+}
+
+} // namespace trimesh
@@ -10,7 +10,6 @@ Miscellaneous filtering operations on trimeshes
 #include "trimesh2/TriMesh.h"
 #include "trimesh2/TriMesh_algo.h"
 #include "trimesh2/lineqn.h"
-#include <numeric>
 using namespace std;
 #define dprintf TriMesh::dprintf
 
@@ -29,42 +28,45 @@ void inflate(TriMesh *mesh, float amount)
 	mesh->need_normals();
 
 	dprintf("Creating offset surface... ");
-	int nv = mesh->vertices.size();
+	ptrdiff_t nv = mesh->vertices.size();
 //#pragma omp parallel for
-	for (int i = 0; i < nv; i++)
+	for (ptrdiff_t i = 0; i < nv; i++)
 		mesh->vertices[i] += amount * mesh->normals[i];
 	dprintf("Done.\n");
-	mesh->bbox.valid = false;
-	mesh->bsphere.valid = false;
+	mesh->changed_geometry();
 }
 
 
 // Transform the mesh by the given matrix
 void apply_xform(TriMesh *mesh, const xform &xf)
 {
-	int nv = mesh->vertices.size();
+	ptrdiff_t nv = mesh->vertices.size();
 
 //#pragma omp parallel for
-	for (int i = 0; i < nv; i++)
+	for (ptrdiff_t i = 0; i < nv; i++)
 		mesh->vertices[i] = xf * mesh->vertices[i];
 
-	if (!mesh->normals.empty()) {
+	// Normals and bounding volumes are transformed (or recomputed)
+	// below, but anything else computed from the geometry is stale
+	bool had_bbox = mesh->bbox.valid, had_bsphere = mesh->bsphere.valid;
+	vector<vec> normals;
+	normals.swap(mesh->normals);
+	mesh->changed_geometry();
+
+	if (!normals.empty()) {
 		xform nxf = norm_xf(xf);
 //#pragma omp parallel for
-		for (int i = 0; i < nv; i++) {
-			mesh->normals[i] = nxf * mesh->normals[i];
-			normalize(mesh->normals[i]);
+		for (ptrdiff_t i = 0; i < nv; i++) {
+			normals[i] = nxf * normals[i];
+			normalize(normals[i]);
 		}
+		mesh->normals.swap(normals);
 	}
 
-	if (mesh->bbox.valid) {
-		mesh->bbox.valid = false;
+	if (had_bbox)
 		mesh->need_bbox();
-	}
-	if (mesh->bsphere.valid) {
-		mesh->bsphere.valid = false;
+	if (had_bsphere)
 		mesh->need_bsphere();
-	}
 }
 
 
@@ -106,9 +108,9 @@ void scale(TriMesh *mesh, float s, const vec &d)
 // Clip mesh to the given bounding box
 void clip(TriMesh *mesh, const box &b)
 {
-	int nv = mesh->vertices.size();
+	ptrdiff_t nv = mesh->vertices.size();
 	vector<bool> toremove(nv, false);
-	for (int i = 0; i < nv; i++)
+	for (ptrdiff_t i = 0; i < nv; i++)
 		if (!b.contains(mesh->vertices[i]))
 			toremove[i] = true;
 
@@ -117,55 +119,58 @@ void clip(TriMesh *mesh, const box &b)
 
 
 // Find center of mass of a bunch of points
-point point_center_of_mass(const vector<point> &pts)
+point point_center_of_mass(const vector<point> &pts,
+                           SumMode mode /* = SUM_DOUBLE */)
 {
-	point com = accumulate(pts.begin(), pts.end(), point());
+	point com = parallel_sum<point>(mode, pts.size(),
+		[&](size_t i) { return pts[i]; });
 	return com / (float) pts.size();
 }
 
 
 // Find (area-weighted) center of mass of a mesh
-point mesh_center_of_mass(TriMesh *mesh)
+point mesh_center_of_mass(TriMesh *mesh, SumMode mode /* = SUM_DOUBLE */)
 {
 	mesh->need_faces();
 	if (mesh->faces.empty() && mesh->tstrips.empty())
-		return point_center_of_mass(mesh->vertices);
+		return point_center_of_mass(mesh->vertices, mode);
 
-	point com;
-	float totwt = 0;
-
-	int nf = mesh->faces.size();
-	for (int i = 0; i < nf; i++) {
+	// Sum of area-weighted face centers, and total area
+	mesh->need_faceareas();
+	Vec<4,float> sum = parallel_sum< Vec<4,float> >(mode,
+			mesh->faces.size(), [&](size_t i) {
 		const point &v0 = mesh->vertices[mesh->faces[i][0]];
 		const point &v1 = mesh->vertices[mesh->faces[i][1]];
 		const point &v2 = mesh->vertices[mesh->faces[i][2]];
 
 		point face_com = (v0+v1+v2) / 3.0f;
-		float wt = len(trinorm(v0,v1,v2));
-		com += wt * face_com;
-		totwt += wt;
-	}
-	return com / totwt;
+		float wt = mesh->faceareas[i];
+		return Vec<4,float>(wt * face_com[0], wt * face_com[1],
+		                    wt * face_com[2], wt);
+	});
+	return point(sum[0], sum[1], sum[2]) / sum[3];
 }
 
 
 // Compute covariance of a bunch of points
-void point_covariance(const vector<point> &pts, float (&C)[3][3])
+void point_covariance(const vector<point> &pts, float (&C)[3][3],
+                      SumMode mode /* = SUM_DOUBLE */)
 {
-	for (int j = 0; j < 3; j++)
-		for (int k = 0; k < 3; k++)
-			C[j][k] = 0.0f;
-
-	int n = pts.size();
-	for (int i = 0; i < n; i++) {
+	// The upper triangle of C, in order
+	Vec<6,float> sum = parallel_sum< Vec<6,float> >(mode, pts.size(),
+			[&](size_t i) {
+		Vec<6,float> c(VEC_UNINITIALIZED);
+		int ind = 0;
 		for (int j = 0; j < 3; j++)
 			for (int k = j; k < 3; k++)
-				C[j][k] += pts[i][j] * pts[i][k];
-	}
+				c[ind++] = pts[i][j] * pts[i][k];
+		return c;
+	});
 
+	int ind = 0;
 	for (int j = 0; j < 3; j++)
 		for (int k = j; k < 3; k++)
-			C[j][k] /= pts.size();
+			C[j][k] = sum[ind++] / pts.size();
 
 	C[1][0] = C[0][1];
 	C[2][0] = C[0][2];
@@ -174,45 +179,48 @@ void point_covariance(const vector<point> &pts, float (&C)[3][3])
 
 
 // Compute covariance of faces (area-weighted) in a mesh
-void mesh_covariance(TriMesh *mesh, float (&C)[3][3])
+void mesh_covariance(TriMesh *mesh, float (&C)[3][3],
+                     SumMode mode /* = SUM_DOUBLE */)
 {
 	mesh->need_faces();
 	if (mesh->faces.empty() && mesh->tstrips.empty()) {
-		point_covariance(mesh->vertices, C);
+		point_covariance(mesh->vertices, C, mode);
 		return;
 	}
 
-	for (int j = 0; j < 3; j++)
-		for (int k = 0; k < 3; k++)
-			C[j][k] = 0.0f;
-
-	float totarea = 0.0f;
+	// The upper triangle of C, in order, and the total area
+	mesh->need_faceareas();
 	const vector<point> &p = mesh->vertices;
-	int n = mesh->faces.size();
-	for (int i = 0; i < n; i++) {
+	Vec<7,float> sum = parallel_sum< Vec<7,float> >(mode,
+			mesh->faces.size(), [&](size_t i) {
 		const TriMesh::Face &f = mesh->faces[i];
 		point c = (p[f[0]] + p[f[1]] + p[f[2]]) / 3.0f;
-		float area = len(trinorm(p[f[0]], p[f[1]], p[f[2]]));
-		totarea += area;
+		float area = mesh->faceareas[i];
+		Vec<7,float> fc;
+		fc[6] = area;
 
 		// Covariance of triangle relative to centroid
 		float vweight = area / 12.0f;
 		for (int v = 0; v < 3; v++) {
 			point pc = p[f[v]] - c;
+			int ind = 0;
 			for (int j = 0; j < 3; j++)
 				for (int k = j; k < 3; k++)
-					C[j][k] += vweight * pc[j] * pc[k];
+					fc[ind++] += vweight * pc[j] * pc[k];
 		}
 
 		// Covariance of centroid
+		int ind = 0;
 		for (int j = 0; j < 3; j++)
 			for (int k = j; k < 3; k++)
-				C[j][k] += area * c[j] * c[k];
-	}
+				fc[ind++] += area * c[j] * c[k];
+		return fc;
+	});
 
+	int ind = 0;
 	for (int j = 0; j < 3; j++)
 		for (int k = j; k < 3; k++)
-			C[j][k] /= totarea;
+			C[j][k] = sum[ind++] / sum[6];
 
 	C[1][0] = C[0][1];
 	C[2][0] = C[0][2];
@@ -251,8 +259,8 @@ void pca_rotate(TriMesh *mesh)
 	// Sorted in order from smallest to largest, so grab third column
 	vec first(C[0][2], C[1][2], C[2][2]);
 	int npos = 0;
-	int nv = mesh->vertices.size();
-	for (int i = 0; i < nv; i++)
+	ptrdiff_t nv = mesh->vertices.size();
+	for (ptrdiff_t i = 0; i < nv; i++)
 		if ((mesh->vertices[i] DOT first) > 0.0f)
 			npos++;
 	if (npos < nv/2)
@@ -260,7 +268,7 @@ void pca_rotate(TriMesh *mesh)
 
 	vec second(C[0][1], C[1][1], C[2][1]);
 	npos = 0;
-	for (int i = 0; i < nv; i++)
+	for (ptrdiff_t i = 0; i < nv; i++)
 		if ((mesh->vertices[i] DOT second) > 0.0f)
 			npos++;
 	if (npos < nv/2)
@@ -294,8 +302,8 @@ void pca_snap(TriMesh *mesh)
 	// Sorted in order from smallest to largest, so grab third column
 	vec first(C[0][2], C[1][2], C[2][2]);
 	int npos = 0;
-	int nv = mesh->vertices.size();
-	for (int i = 0; i < nv; i++)
+	ptrdiff_t nv = mesh->vertices.size();
+	for (ptrdiff_t i = 0; i < nv; i++)
 		if ((mesh->vertices[i] DOT first) > 0.0f)
 			npos++;
 	if (npos < nv/2)
@@ -320,7 +328,7 @@ void pca_snap(TriMesh *mesh)
 
 	vec second(C[0][1], C[1][1], C[2][1]);
 	npos = 0;
-	for (int i = 0; i < nv; i++)
+	for (ptrdiff_t i = 0; i < nv; i++)
 		if ((mesh->vertices[i] DOT second) > 0.0f)
 			npos++;
 	if (npos < nv/2)
@@ -381,8 +389,8 @@ void orient(TriMesh *mesh)
 	dprintf("Auto-orienting mesh... ");
 	unsigned cc = 0;
 	vector<int> cc_farthest;
-	int nf = mesh->faces.size();
-	for (int i = 0; i < nf; i++) {
+	ptrdiff_t nf = mesh->faces.size();
+	for (ptrdiff_t i = 0; i < nf; i++) {
 		if (mesh->flags[i] != NONE)
 			continue;
 		mesh->flags[i] = cc;
@@ -397,7 +405,7 @@ void orient(TriMesh *mesh)
 			for (int j = 0; j < 3; j++) {
 				int v0 = mesh->faces[f][j];
 				int v1 = mesh->faces[f][NEXT_MOD3(j)];
-				const vector<int> &a = mesh->adjacentfaces[v0];
+				Adjacency::const_range a = mesh->adjacentfaces[v0];
 				for (size_t k = 0; k < a.size(); k++) {
 					int f1 = a[k];
 					if (mesh->flags[f1] != NONE)
@@ -433,7 +441,7 @@ void orient(TriMesh *mesh)
 		else
 			if (v2[0] > v0[0]) j = 2;
 		int v = mesh->faces[f][j];
-		const vector<int> &a = mesh->adjacentfaces[v];
+		Adjacency::const_range a = mesh->adjacentfaces[v];
 		vec n;
 		for (size_t k = 0; k < a.size(); k++) {
 			int f1 = a[k];
@@ -446,10 +454,19 @@ void orient(TriMesh *mesh)
 			cc_flip[i] = true;
 	}
 
-	for (int i = 0; i < nf; i++) {
+	for (ptrdiff_t i = 0; i < nf; i++) {
 		if (cc_flip[mesh->flags[i]])
 			swap(mesh->faces[i][1], mesh->faces[i][2]);
 	}
+
+	// Flipping faces leaves the vertices' neighbors and adjacent faces
+	// alone, but changes the order of the faces' vertices (and so
+	// across_edge and the edges) and which way the surface faces
+	mesh->topology_generation++;
+	mesh->changed_geometry();
+	mesh->clear_across_edge();
+	mesh->clear_edges();
+	mesh->clear_boundary_loops();
 	dprintf("Done.\n");
 }
 
@@ -457,9 +474,9 @@ void orient(TriMesh *mesh)
 // Remove boundary vertices (and faces that touch them)
 void erode(TriMesh *mesh)
 {
-	int nv = mesh->vertices.size();
+	ptrdiff_t nv = mesh->vertices.size();
 	vector<bool> bdy(nv);
-	for (int i = 0; i < nv; i++)
+	for (ptrdiff_t i = 0; i < nv; i++)
 		bdy[i] = mesh->is_bdy(i);
 	remove_vertices(mesh, bdy);
 }
@@ -470,14 +487,14 @@ void noisify(TriMesh *mesh, float amount)
 {
 	mesh->need_normals();
 	mesh->need_neighbors();
-	int nv = mesh->vertices.size();
+	ptrdiff_t nv = mesh->vertices.size();
 	vector<vec> disp(nv);
 
-	for (int i = 0; i < nv; i++) {
+	for (ptrdiff_t i = 0; i < nv; i++) {
 		point &v = mesh->vertices[i];
 		// Tangential
-		int nn = mesh->neighbors[i].size();
-		for (int j = 0; j < nn; j++) {
+		ptrdiff_t nn = mesh->neighbors[i].size();
+		for (ptrdiff_t j = 0; j < nn; j++) {
 			const point &n = mesh->vertices[mesh->neighbors[i][j]];
 			float scale = amount / (amount + len(n-v));
 			disp[i] += uniform_rnd(scale) * (n-v);
@@ -487,8 +504,9 @@ void noisify(TriMesh *mesh, float amount)
 		// Normal
 		disp[i] += normal_rnd(amount) * mesh->normals[i];
 	}
-	for (int i = 0; i < nv; i++)
+	for (ptrdiff_t i = 0; i < nv; i++)
 		mesh->vertices[i] += disp[i];
+	mesh->changed_geometry();
 }
 
 } // namespace trimesh
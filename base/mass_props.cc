@@ -0,0 +1,218 @@
+/*
+mass_props.cc
+Volume, surface area, centroid, and inertia tensor of the solid bounded
+by a closed mesh, for the whole mesh or for each connected component.
+
+The volume integrals follow
+ Eberly, D.
+ "Polyhedral Mass Properties (Revisited),"
+ Geometric Tools technical report, 2002.
+Each face contributes independently, in double precision and relative to
+a reference point on the same part (so coordinates far from the origin do
+not cost precision).  The faces are processed a batch at a time, in
+vector lanes as in FaceKernels.h, and the batches' contributions are
+added up with sum_blocks, so the results do not depend on the number of
+threads.
+*/
+
+#include "trimesh2/TriMesh.h"
+#include "trimesh2/TriMesh_algo.h"
+#include "trimesh2/Accumulate.h"
+#include "trimesh2/FaceKernels.h"
+using namespace std;
+#define dprintf TriMesh::dprintf
+
+
+namespace trimesh {
+
+// The integrals of 1, x, y, z, x^2, y^2, z^2, xy, yz, zx over the solid
+// (times 6, 24, 24, 24, 60, 60, 60, 120, 120, 120), and twice the area
+typedef Vec<11,double> FaceIntegrals;
+
+// Number of faces per batch
+static const int BATCH = 8;
+
+
+// Helper for face_integrals: sums of powers of one coordinate
+static FACE_INLINE void subexpressions(double w0, double w1, double w2,
+                                  double &f1, double &f2, double &f3,
+                                  double &g0, double &g1, double &g2)
+{
+	double temp0 = w0 + w1;
+	f1 = temp0 + w2;
+	double temp1 = w0 * w0;
+	double temp2 = temp1 + w1 * temp0;
+	f2 = temp2 + w2 * f1;
+	f3 = w0 * temp1 + w1 * temp2 + w2 * f2;
+	g0 = f2 + w0 * (f1 + w0);
+	g1 = f2 + w1 * (f1 + w1);
+	g2 = f2 + w2 * (f1 + w2);
+}
+
+
+// The total contribution of faces which[0] through which[n-1] (n <= BATCH),
+// with coordinates relative to ref
+static FACE_KERNEL FaceIntegrals face_integrals(const TriMesh *mesh,
+	const int *which, int n, const dvec3 &ref)
+{
+	// Coordinate c of the vertex at corner j of each face is p[j][c].
+	// Lanes past n repeat the last face.
+	double p[3][3][BATCH];
+	for (int k = 0; k < BATCH; k++) {
+		const TriMesh::Face &f = mesh->faces[which[(k < n) ? k : n - 1]];
+		for (int j = 0; j < 3; j++) {
+			const point &v = mesh->vertices[f[j]];
+			p[j][0][k] = double(v[0]) - ref[0];
+			p[j][1][k] = double(v[1]) - ref[1];
+			p[j][2][k] = double(v[2]) - ref[2];
+		}
+	}
+
+	double fi[11][BATCH];
+#pragma omp simd
+	for (int k = 0; k < BATCH; k++) {
+		double x0 = p[0][0][k], y0 = p[0][1][k], z0 = p[0][2][k];
+		double x1 = p[1][0][k], y1 = p[1][1][k], z1 = p[1][2][k];
+		double x2 = p[2][0][k], y2 = p[2][1][k], z2 = p[2][2][k];
+		double ax = x1 - x0, ay = y1 - y0, az = z1 - z0;
+		double bx = x2 - x0, by = y2 - y0, bz = z2 - z0;
+		double dx = ay * bz - az * by;
+		double dy = az * bx - ax * bz;
+		double dz = ax * by - ay * bx;
+
+		double f1x, f2x, f3x, g0x, g1x, g2x;
+		double f1y, f2y, f3y, g0y, g1y, g2y;
+		double f1z, f2z, f3z, g0z, g1z, g2z;
+		subexpressions(x0, x1, x2, f1x, f2x, f3x, g0x, g1x, g2x);
+		subexpressions(y0, y1, y2, f1y, f2y, f3y, g0y, g1y, g2y);
+		subexpressions(z0, z1, z2, f1z, f2z, f3z, g0z, g1z, g2z);
+
+		fi[0][k] = dx * f1x;
+		fi[1][k] = dx * f2x;
+		fi[2][k] = dy * f2y;
+		fi[3][k] = dz * f2z;
+		fi[4][k] = dx * f3x;
+		fi[5][k] = dy * f3y;
+		fi[6][k] = dz * f3z;
+		fi[7][k] = dx * (y0 * g0x + y1 * g1x + y2 * g2x);
+		fi[8][k] = dy * (z0 * g0y + z1 * g1y + z2 * g2y);
+		fi[9][k] = dz * (x0 * g0z + x1 * g1z + x2 * g2z);
+		fi[10][k] = dx * dx + dy * dy + dz * dz;
+	}
+
+	// The square roots are left out of the loop above, since they can
+	// set errno, which would keep it from being vectorized
+	FaceIntegrals sum;
+	for (int k = 0; k < n; k++) {
+		for (int m = 0; m < 10; m++)
+			sum[m] += fi[m][k];
+		sum[10] += ::std::sqrt(fi[10][k]);
+	}
+	return sum;
+}
+
+
+// Mass properties of the faces face(0) through face(n-1)
+template <class Func>
+static MassProperties mass_props(const TriMesh *mesh, size_t n, Func face)
+{
+	MassProperties props;
+	props.volume = props.area = 0.0;
+	for (int j = 0; j < 3; j++)
+		for (int k = 0; k < 3; k++)
+			props.inertia[j][k] = 0.0;
+	if (!n)
+		return props;
+
+	dvec3 ref(mesh->vertices[mesh->faces[face(0)][0]]);
+	size_t nbatches = (n + BATCH - 1) / BATCH;
+	FaceIntegrals in = sum_blocks< SimpleSum<FaceIntegrals> >(nbatches,
+		[&](size_t b) {
+			int which[BATCH];
+			int nb = int(min(size_t(BATCH), n - b * BATCH));
+			for (int k = 0; k < nb; k++)
+				which[k] = face(b * BATCH + k);
+			return face_integrals(mesh, which, nb, ref);
+		});
+
+	in[0] *= 1.0 / 6.0;
+	in[1] *= 1.0 / 24.0; in[2] *= 1.0 / 24.0; in[3] *= 1.0 / 24.0;
+	in[4] *= 1.0 / 60.0; in[5] *= 1.0 / 60.0; in[6] *= 1.0 / 60.0;
+	in[7] *= 1.0 / 120.0; in[8] *= 1.0 / 120.0; in[9] *= 1.0 / 120.0;
+
+	props.volume = in[0];
+	props.area = 0.5 * in[10];
+	if (in[0] == 0.0) {
+		props.centroid = ref;
+		return props;
+	}
+
+	// Centroid, relative to ref
+	dvec3 c(in[1] / in[0], in[2] / in[0], in[3] / in[0]);
+	props.centroid = ref + c;
+
+	// Inertia tensor relative to the centroid.  An inside-out mesh has
+	// negative volume, and all the integrals flip sign with it.
+	double s = (in[0] < 0.0) ? -1.0 : 1.0;
+	double m = s * in[0];
+	props.inertia[0][0] = s * (in[5] + in[6]) - m * (sqr(c[1]) + sqr(c[2]));
+	props.inertia[1][1] = s * (in[4] + in[6]) - m * (sqr(c[2]) + sqr(c[0]));
+	props.inertia[2][2] = s * (in[4] + in[5]) - m * (sqr(c[0]) + sqr(c[1]));
+	props.inertia[0][1] = props.inertia[1][0] = m * c[0] * c[1] - s * in[7];
+	props.inertia[1][2] = props.inertia[2][1] = m * c[1] * c[2] - s * in[8];
+	props.inertia[0][2] = props.inertia[2][0] = m * c[2] * c[0] - s * in[9];
+	return props;
+}
+
+
+// Mass properties of the whole mesh
+MassProperties mesh_mass_properties(TriMesh *mesh)
+{
+	mesh->need_faces();
+	return mass_props(mesh, mesh->faces.size(),
+		[](size_t i) { return int(i); });
+}
+
+
+// Mass properties of each connected component, as found by find_comps
+void comp_mass_properties(TriMesh *mesh, const vector<int> &comps,
+                          const vector<int> &compsizes,
+                          vector<MassProperties> &props)
+{
+	mesh->need_faces();
+	ptrdiff_t nf = mesh->faces.size(), ncomps = compsizes.size();
+
+	// The faces of each component, in order
+	vector<size_t> offsets(ncomps + 1);
+	for (ptrdiff_t c = 0; c < ncomps; c++)
+		offsets[c+1] = offsets[c] + compsizes[c];
+	vector<int> compfaces(offsets[ncomps]);
+	vector<size_t> next(offsets.begin(), offsets.end() - 1);
+	for (ptrdiff_t i = 0; i < nf; i++)
+		compfaces[next[comps[i]]++] = i;
+
+	dprintf("Computing mass properties of %ld components... ",
+		(long) ncomps);
+	props.resize(ncomps);
+
+	// Big components (more than one block of batches for sum_blocks) are
+	// summed in parallel, one at a time, and the (many) small ones are
+	// handed out to threads whole
+	const int big = SUM_BLOCK * BATCH;
+	int nbig = 0;
+	while (nbig < ncomps && compsizes[nbig] >= big) {
+		const int *f = &compfaces[offsets[nbig]];
+		props[nbig] = mass_props(mesh, compsizes[nbig],
+			[f](size_t i) { return f[i]; });
+		nbig++;
+	}
+#pragma omp parallel for schedule(dynamic,16)
+	for (int c = nbig; c < ncomps; c++) {
+		const int *f = &compfaces[offsets[c]];
+		props[c] = mass_props(mesh, compsizes[c],
+			[f](size_t i) { return f[i]; });
+	}
+	dprintf("Done.\n");
+}
+
+} // namespace trimesh
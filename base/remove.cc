@@ -17,7 +17,7 @@ namespace trimesh {
 // Remove the indicated vertices from the TriMesh.
 void remove_vertices(TriMesh *mesh, const vector<bool> &toremove)
 {
-	int nv = mesh->vertices.size();
+	ptrdiff_t nv = mesh->vertices.size();
 
 	// Build a table that tells how the vertices will be remapped
 	if (!nv)
@@ -25,7 +25,7 @@ void remove_vertices(TriMesh *mesh, const vector<bool> &toremove)
 
 	vector<int> remap_table(nv);
 	int next = 0;
-	for (int i = 0; i < nv; i++) {
+	for (ptrdiff_t i = 0; i < nv; i++) {
 		if (toremove[i])
 			remap_table[i] = -1;
 		else
@@ -38,22 +38,22 @@ void remove_vertices(TriMesh *mesh, const vector<bool> &toremove)
 
 	dprintf("Removing vertices... ");
 	remap_verts(mesh, remap_table);
-	dprintf("%d vertices removed... Done.\n", nv - next);
+	dprintf("%ld vertices removed... Done.\n", (long) (nv - next));
 }
 
 
 // Remove vertices that aren't referenced by any face
 void remove_unused_vertices(TriMesh *mesh)
 {
-	int nv = mesh->vertices.size();
+	ptrdiff_t nv = mesh->vertices.size();
 	if (!nv)
 		return;
 
 	bool had_faces = !mesh->faces.empty();
 	mesh->need_faces();
-	int nf = mesh->faces.size();
+	ptrdiff_t nf = mesh->faces.size();
 	vector<bool> unused(nv, true);
-	for (int i = 0; i < nf; i++) {
+	for (ptrdiff_t i = 0; i < nf; i++) {
 		unused[mesh->faces[i][0]] = false;
 		unused[mesh->faces[i][1]] = false;
 		unused[mesh->faces[i][2]] = false;
@@ -71,30 +71,55 @@ void remove_faces(TriMesh *mesh, const vector<bool> &toremove)
 	bool had_tstrips = !mesh->tstrips.empty();
 	bool had_faces = !mesh->faces.empty();
 	mesh->need_faces();
-	int numfaces = mesh->faces.size();
+	ptrdiff_t numfaces = mesh->faces.size();
 	if (!numfaces)
 		return;
 
-	mesh->clear_tstrips();
-	mesh->clear_adjacentfaces();
-	mesh->clear_neighbors();
-	mesh->clear_across_edge();
-	mesh->clear_pointareas();
-
-	dprintf("Removing faces... ");
+	vector<int> face_remap(numfaces);
 	int next = 0;
-	for (int i = 0; i < numfaces; i++) {
-		if (toremove[i])
-			continue;
-		mesh->faces[next++] = mesh->faces[i];
-	}
+	for (ptrdiff_t i = 0; i < numfaces; i++)
+		face_remap[i] = toremove[i] ? -1 : next++;
 	if (next == numfaces) {
-		dprintf("None removed.\n");
+		dprintf("Removing faces... None removed.\n");
+		if (!had_faces)
+			mesh->clear_faces();
 		return;
 	}
 
+	// Fix up connectivity while the old faces are still around
+	mesh->patch_connectivity(face_remap);
+
+	dprintf("Removing faces... ");
+	bool have_facenormals = ptrdiff_t(mesh->facenormals.size()) == numfaces;
+	bool have_faceareas = ptrdiff_t(mesh->faceareas.size()) == numfaces;
+	for (ptrdiff_t i = 0; i < numfaces; i++) {
+		int j = face_remap[i];
+		if (j < 0)
+			continue;
+		mesh->faces[j] = mesh->faces[i];
+		if (have_facenormals)
+			mesh->facenormals[j] = mesh->facenormals[i];
+		if (have_faceareas)
+			mesh->faceareas[j] = mesh->faceareas[i];
+	}
+
+	// Per-vertex normals and curvatures are kept: they are still
+	// approximately right.  Point areas are not.  Face normals and
+	// areas are exact, and just go along with their faces.
 	mesh->faces.erase(mesh->faces.begin() + next, mesh->faces.end());
-	dprintf("%d faces removed... Done.\n", numfaces - next);
+	if (have_facenormals)
+		mesh->facenormals.resize(next);
+	else
+		mesh->clear_facenormals();
+	if (have_faceareas)
+		mesh->faceareas.resize(next);
+	else
+		mesh->clear_faceareas();
+	mesh->clear_tstrips();
+	mesh->topology_generation++;
+	mesh->geometry_generation++;
+	mesh->clear_pointareas();
+	dprintf("%ld faces removed... Done.\n", (long) (numfaces - next));
 
 	if (had_tstrips)
 		mesh->need_tstrips();
@@ -111,12 +136,12 @@ void remove_faces(TriMesh *mesh, const vector<bool> &toremove)
 void remove_sliver_faces(TriMesh *mesh)
 {
 	mesh->need_faces();
-	int numfaces = mesh->faces.size();
+	ptrdiff_t numfaces = mesh->faces.size();
 
 	const float l2thresh = sqr(4.0f * mesh->feature_size());
 	const float cos2thresh = 0.85f;
 	vector<bool> toremove(numfaces, false);
-	for (int i = 0; i < numfaces; i++) {
+	for (ptrdiff_t i = 0; i < numfaces; i++) {
 		const point &v0 = mesh->vertices[mesh->faces[i][0]];
 		const point &v1 = mesh->vertices[mesh->faces[i][1]];
 		const point &v2 = mesh->vertices[mesh->faces[i][2]];
@@ -8,6 +8,7 @@ Reorder and remap vertices.
 
 #include "trimesh2/TriMesh.h"
 #include "trimesh2/TriMesh_algo.h"
+#include <algorithm>
 using namespace std;
 #define dprintf TriMesh::dprintf
 #define eprintf TriMesh::eprintf
@@ -31,8 +32,8 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 	// Check what we're doing
 	bool removing_verts = false, any_left = false;
 	int last = -1;
-	int nv = mesh->vertices.size();
-	for (int i = 0; i < nv; i++) {
+	ptrdiff_t nv = mesh->vertices.size();
+	for (ptrdiff_t i = 0; i < nv; i++) {
 		if (remap_table[i] < 0) {
 			removing_verts = true;
 		} else {
@@ -47,6 +48,20 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 		return;
 	}
 
+	// Are any vertices being merged together?
+	bool merging_verts = false;
+	vector<bool> used(last + 1);
+	for (ptrdiff_t i = 0; i < nv; i++) {
+		int j = remap_table[i];
+		if (j < 0)
+			continue;
+		if (used[j]) {
+			merging_verts = true;
+			break;
+		}
+		used[j] = true;
+	}
+
 	// Figure out what we have sitting around, so we can remap/recompute
 	bool have_faces = !mesh->faces.empty();
 	bool have_tstrips = !mesh->tstrips.empty();
@@ -54,7 +69,7 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 	if (removing_verts) {
 		if (have_grid) {
 			// Remap the grid, recompute faces/tstrips if necessary
-			mesh->faces.clear();
+			mesh->clear_faces();
 			mesh->tstrips.clear();
 		} else if (have_tstrips) {
 			// Remap faces, will recompute tstrips
@@ -62,6 +77,52 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 			mesh->tstrips.clear();
 		}
 	}
+	bool have_pointareas = !mesh->pointareas.empty() ||
+	                       !mesh->cornerareas.empty();
+	bool have_facenormals = !mesh->facenormals.empty();
+	bool have_faceareas = !mesh->faceareas.empty();
+	bool have_bbox = mesh->bbox.valid;
+	bool have_bsphere = mesh->bsphere.valid;
+
+	// Faces that use a removed vertex go away.  Removing them first lets
+	// remove_faces() patch the connectivity, which then only needs to be
+	// renumbered below, instead of recomputed.  That only works if each
+	// kept vertex keeps its own identity: if vertices are merged, their
+	// neighbors and faces (and the edges between them) combine, so the
+	// connectivity is recomputed.
+	bool renumber_connectivity = !merging_verts &&
+	                             !(removing_verts && have_grid);
+	bool have_neighbors = !mesh->neighbors.empty();
+	bool have_adjacentfaces = !mesh->adjacentfaces.empty();
+	bool have_across_edge = !mesh->across_edge.empty();
+	bool have_edges = !mesh->edges.empty();
+	bool have_boundary_loops = !mesh->boundary_loops.empty();
+	if (removing_verts && !have_grid && !mesh->faces.empty()) {
+		ptrdiff_t nf = mesh->faces.size();
+		vector<bool> toremove(nf);
+		for (ptrdiff_t i = 0; i < nf; i++) {
+			const TriMesh::Face &f = mesh->faces[i];
+			toremove[i] = remap_table[f[0]] < 0 ||
+			              remap_table[f[1]] < 0 ||
+			              remap_table[f[2]] < 0;
+		}
+		remove_faces(mesh, toremove);
+	}
+
+	// Keep the connectivity out of the copy below.  Edges are
+	// recomputed, since renumbering changes their order.
+	Adjacency neighbors, adjacentfaces;
+	vector<TriMesh::Face> across_edge;
+	if (renumber_connectivity) {
+		neighbors.swap(mesh->neighbors);
+		adjacentfaces.swap(mesh->adjacentfaces);
+		across_edge.swap(mesh->across_edge);
+	} else {
+		mesh->clear_neighbors();
+		mesh->clear_adjacentfaces();
+		mesh->clear_across_edge();
+	}
+	mesh->clear_edges();
 
 	bool have_col = !mesh->colors.empty();
 	bool have_conf = !mesh->confidences.empty();
@@ -79,7 +140,7 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 
 #define REMAP(property) mesh->property[remap_table[i]] = oldmesh->property[i]
 
-	for (int i = 0; i < nv; i++) {
+	for (ptrdiff_t i = 0; i < nv; i++) {
 		if (remap_table[i] < 0 || remap_table[i] == i)
 			continue;
 		REMAP(vertices);
@@ -108,8 +169,8 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 	if (have_dcurv) ERASE(dcurv);
 
 	// Renumber faces
-	int nf = mesh->faces.size(), nextface = 0;
-	for (int i = 0; i < nf; i++) {
+	ptrdiff_t nf = mesh->faces.size(), nextface = 0;
+	for (ptrdiff_t i = 0; i < nf; i++) {
 		int n0 = (mesh->faces[nextface][0] = remap_table[oldmesh->faces[i][0]]);
 		int n1 = (mesh->faces[nextface][1] = remap_table[oldmesh->faces[i][1]]);
 		int n2 = (mesh->faces[nextface][2] = remap_table[oldmesh->faces[i][2]]);
@@ -120,8 +181,8 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 
 	// Renumber grid
 	if (have_grid) {
-		int ng = mesh->grid.size();
-		for (int i = 0; i < ng; i++) {
+		ptrdiff_t ng = mesh->grid.size();
+		for (ptrdiff_t i = 0; i < ng; i++) {
 			if (mesh->grid[i] >= 0)
 				mesh->grid[i] = remap_table[oldmesh->grid[i]];
 		}
@@ -132,8 +193,8 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 	// Renumber tstrips if we're keeping (vs. recomputing) them.
 	if (!mesh->tstrips.empty()) {
 		oldmesh->convert_strips(TriMesh::TSTRIP_TERM);
-		int ns = mesh->tstrips.size();
-		for (int i = 0; i < ns; i++) {
+		ptrdiff_t ns = mesh->tstrips.size();
+		for (ptrdiff_t i = 0; i < ns; i++) {
 			if (oldmesh->tstrips[i] < 0)
 				mesh->tstrips[i] = -1;
 			else
@@ -143,38 +204,93 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 	}
 
 	// Recompute whatever needs recomputing...
-	if (!mesh->pointareas.empty() || !mesh->cornerareas.empty()) {
+	mesh->topology_generation++;
+	mesh->geometry_generation++;
+	if (have_pointareas) {
 		mesh->pointareas.clear();
 		mesh->cornerareas.clear();
 		mesh->need_pointareas();
 	}
-	if (mesh->bbox.valid) {
+	// Merging vertices moves the corners of the faces that used them
+	if (merging_verts && have_facenormals) {
+		mesh->clear_facenormals();
+		mesh->need_facenormals();
+	}
+	if (merging_verts && have_faceareas) {
+		mesh->clear_faceareas();
+		mesh->need_faceareas();
+	}
+	if (have_bbox) {
 		mesh->bbox.valid = false;
 		mesh->need_bbox();
 	}
-	if (mesh->bsphere.valid) {
+	if (have_bsphere) {
 		mesh->bsphere.valid = false;
 		mesh->need_bsphere();
 	}
-	if (!mesh->neighbors.empty()) {
-		mesh->neighbors.clear();
-		mesh->need_neighbors();
+	if (renumber_connectivity) {
+		// The faces are the same (and in the same order) as before, so
+		// only the vertex numbers in the lists need changing
+		ptrdiff_t newnv = mesh->vertices.size();
+		if (!neighbors.empty()) {
+			vector<int> sizes(newnv);
+			for (ptrdiff_t i = 0; i < nv; i++)
+				if (remap_table[i] >= 0)
+					sizes[remap_table[i]] = neighbors[i].size();
+			mesh->neighbors.set_sizes(sizes);
+#pragma omp parallel for
+			for (ptrdiff_t i = 0; i < nv; i++) {
+				if (remap_table[i] < 0)
+					continue;
+				Adjacency::const_range a = neighbors[i];
+				Adjacency::range n = mesh->neighbors[remap_table[i]];
+				for (size_t k = 0; k < a.size(); k++)
+					n[k] = remap_table[a[k]];
+				sort(n.begin(), n.end());
+			}
+		}
+		if (!adjacentfaces.empty()) {
+			vector<int> sizes(newnv);
+			for (ptrdiff_t i = 0; i < nv; i++)
+				if (remap_table[i] >= 0)
+					sizes[remap_table[i]] = adjacentfaces[i].size();
+			mesh->adjacentfaces.set_sizes(sizes);
+#pragma omp parallel for
+			for (ptrdiff_t i = 0; i < nv; i++) {
+				if (remap_table[i] < 0)
+					continue;
+				Adjacency::const_range a = adjacentfaces[i];
+				copy(a.begin(), a.end(),
+				     mesh->adjacentfaces[remap_table[i]].begin());
+			}
+		}
+		mesh->across_edge.swap(across_edge);
+		vector<int> &loops = mesh->boundary_loops.indices;
+		for (size_t i = 0; i < loops.size(); i++)
+			loops[i] = remap_table[loops[i]];
+	} else {
+		mesh->clear_boundary_loops();
 	}
-	if (!mesh->adjacentfaces.empty()) {
-		mesh->adjacentfaces.clear();
+
+	// Recompute whatever could not be renumbered (including anything
+	// remove_faces() had to give up on)
+	if (have_neighbors)
+		mesh->need_neighbors();
+	if (have_adjacentfaces)
 		mesh->need_adjacentfaces();
-	}
-	if (!mesh->across_edge.empty()) {
-		mesh->across_edge.clear();
+	if (have_across_edge)
 		mesh->need_across_edge();
-	}
+	if (have_boundary_loops)
+		mesh->need_boundary_loops();
+	if (have_edges)
+		mesh->need_edges();
 
 	// Must recompute tstrips after connectivity is recomputed...
 	if (have_tstrips)
 		mesh->need_tstrips();
 
 	if (!have_faces)
-		mesh->faces.clear();
+		mesh->clear_faces();
 
 	delete oldmesh;
 }
@@ -189,7 +305,7 @@ void reorder_verts(TriMesh *mesh)
 
 	dprintf("Reordering vertices... ");
 
-	int nv = mesh->vertices.size();
+	ptrdiff_t nv = mesh->vertices.size();
 	vector<int> remap(nv, -1);
 	int next = 0;
 	if (!mesh->grid.empty()) {
@@ -222,7 +338,7 @@ void reorder_verts(TriMesh *mesh)
 
 	if (next != nv) {
 		// Unreferenced vertices...  Just stick them at the end.
-		for (int i = 0; i < nv; i++)
+		for (ptrdiff_t i = 0; i < nv; i++)
 			if (remap[i] == -1)
 				remap[i] = next++;
 	}
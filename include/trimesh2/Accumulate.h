@@ -0,0 +1,210 @@
+#ifndef ACCUMULATE_H
+#define ACCUMULATE_H
+/*
+Accumulate.h
+Policies for summing many values (floats, or Vecs of them) with
+different tradeoffs between speed and accuracy, and a parallel sum whose
+result does not depend on the number of threads.
+
+Each policy Sum<T> provides:
+	Sum<T> s;
+	s.add(x);           // Add a value of type T
+	s.merge(s2);        // Add everything summed by another Sum<T>
+	T total = s.sum();
+
+SimpleSum<T>    sums in T, as a plain loop would
+DoubleSum<T>    sums in double (or a Vec of doubles)
+KahanSum<T>     sums in T, with Kahan compensation for the roundoff
+PairwiseSum<T>  sums in T, combining partial sums in a binary tree
+
+KahanSum depends on the compiler not reassociating floating-point
+arithmetic, so it should not be built with -ffast-math.
+
+Usage:
+	float total = parallel_sum<float>(SUM_KAHAN, n,
+		[&](size_t i) { return vals[i]; });
+	vec c = sum_blocks< DoubleSum<vec> >(n,
+		[&](size_t i) { return pts[i]; });
+*/
+
+#include "Vec.h"
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+namespace trimesh {
+
+// Run-time choice of policy, for functions that take one
+enum SumMode { SUM_FLOAT, SUM_DOUBLE, SUM_KAHAN, SUM_PAIRWISE };
+
+
+// The double-precision version of a type
+template <class T> struct DoubleOf { typedef T type; };
+template <> struct DoubleOf<float> { typedef double type; };
+template <size_t D> struct DoubleOf< Vec<D,float> >
+	{ typedef Vec<D,double> type; };
+
+
+template <class T>
+class SimpleSum {
+private:
+	T s;
+
+public:
+	typedef T value_type;
+	SimpleSum() : s() {}
+	void add(const T &x) { s += x; }
+	void merge(const SimpleSum &o) { s += o.s; }
+	T sum() const { return s; }
+};
+
+
+template <class T>
+class DoubleSum {
+private:
+	typedef typename DoubleOf<T>::type D;
+	D s;
+
+public:
+	typedef T value_type;
+	DoubleSum() : s() {}
+	void add(const T &x) { s += D(x); }
+	void merge(const DoubleSum &o) { s += o.s; }
+	T sum() const { return T(s); }
+};
+
+
+// The true sum is s - c, where c is the roundoff lost so far
+template <class T>
+class KahanSum {
+private:
+	T s, c;
+
+public:
+	typedef T value_type;
+	KahanSum() : s(), c() {}
+	void add(const T &x)
+	{
+		T y = x - c;
+		T t = s + y;
+		c = (t - s) - y;
+		s = t;
+	}
+	void merge(const KahanSum &o) { c += o.c; add(o.s); }
+	T sum() const { return s - c; }
+};
+
+
+// Number of values summed serially by sum_blocks before the partial sums
+// are combined
+enum { SUM_BLOCK = 1024 };
+
+
+// Values are added up in runs of LEAF, and the runs are then combined
+// like a binary counter: two partial sums covering the same number of
+// runs are added together.  The error therefore grows with the log of
+// the number of values rather than linearly, using only a small fixed
+// amount of storage.  There are enough levels for one block of
+// sum_blocks; past 2^MAXLEVELS - 1 runs, further runs are added to the
+// last partial sum.
+template <class T>
+class PairwiseSum {
+private:
+	enum { LEAF = 16, MAXLEVELS = 8 };
+	static_assert((LEAF << MAXLEVELS) > SUM_BLOCK,
+		"PairwiseSum has too few levels for one block");
+	T leaf;
+	int nleaf, nlevels;
+	T partial[MAXLEVELS];
+	int level[MAXLEVELS];
+
+public:
+	typedef T value_type;
+	PairwiseSum() : leaf(), nleaf(0), nlevels(0) {}
+	void add(const T &x)
+	{
+		leaf += x;
+		if (++nleaf < LEAF)
+			return;
+		T p = leaf;
+		int l = 0;
+		while (nlevels && level[nlevels-1] == l) {
+			p = partial[--nlevels] + p;
+			l++;
+		}
+		if (nlevels == MAXLEVELS)
+			partial[nlevels-1] += p;
+		else {
+			partial[nlevels] = p;
+			level[nlevels++] = l;
+		}
+		leaf = T();
+		nleaf = 0;
+	}
+	// The sum so far becomes one partial sum, added to o's.  sum_blocks
+	// merges equal-sized blocks, so this continues the tree.
+	void merge(const PairwiseSum &o)
+	{
+		leaf = sum() + o.sum();
+		nleaf = nlevels = 0;
+	}
+	T sum() const
+	{
+		T s = leaf;
+		for (int i = nlevels - 1; i >= 0; i--)
+			s = partial[i] + s;
+		return s;
+	}
+};
+
+
+// Sum value(i) for i from 0 to n-1 using policy Sum, in parallel.  The
+// values are summed in blocks of a fixed size, and the blocks' sums are
+// combined in a fixed binary tree, so the result is the same (to the bit)
+// for any number of threads.
+template <class Sum, class Func>
+static inline typename Sum::value_type sum_blocks(size_t n, Func value)
+{
+	const size_t block = SUM_BLOCK;
+	ptrdiff_t nblocks = (n + block - 1) / block;
+	if (nblocks <= 1) {
+		Sum s;
+		for (size_t i = 0; i < n; i++)
+			s.add(value(i));
+		return s.sum();
+	}
+
+	::std::vector<Sum> partial(nblocks);
+#pragma omp parallel for
+	for (ptrdiff_t b = 0; b < nblocks; b++) {
+		size_t end = ::std::min(n, (b + 1) * block);
+		for (size_t i = b * block; i < end; i++)
+			partial[b].add(value(i));
+	}
+	for (ptrdiff_t stride = 1; stride < nblocks; stride *= 2) {
+		for (ptrdiff_t b = 0; b + stride < nblocks; b += 2 * stride)
+			partial[b].merge(partial[b + stride]);
+	}
+	return partial[0].sum();
+}
+
+
+// As above, with the policy chosen at run time
+template <class T, class Func>
+static inline T parallel_sum(SumMode mode, size_t n, Func value)
+{
+	switch (mode) {
+		case SUM_FLOAT:
+			return sum_blocks< SimpleSum<T> >(n, value);
+		case SUM_KAHAN:
+			return sum_blocks< KahanSum<T> >(n, value);
+		case SUM_PAIRWISE:
+			return sum_blocks< PairwiseSum<T> >(n, value);
+		default:
+			return sum_blocks< DoubleSum<T> >(n, value);
+	}
+}
+
+} // namespace trimesh
+
+#endif
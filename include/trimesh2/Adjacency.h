@@ -0,0 +1,111 @@
+#ifndef ADJACENCY_H
+#define ADJACENCY_H
+/*
+Adjacency.h
+Compressed ("CSR") storage for per-element lists of indices, such as the
+neighbors or adjacent faces of each vertex.  The lists are stored back
+to back in a single array, with an array of offsets saying where each
+one starts, so there is no per-list allocation or overhead.
+
+Usage:
+	Adjacency a;
+	...
+	for (int i : a[v]) ...           // Iterate over list for v
+	int n = a[v].size(), x = a[v][0];
+	vector<int> copy = a[v];         // Make a copy, for legacy code
+*/
+
+#include <vector>
+#include <cstddef>
+
+namespace trimesh {
+
+class Adjacency {
+public:
+	// A lightweight view of one list, with vector-like accessors
+	template <class T>
+	class Range {
+	private:
+		T *b, *e;
+
+	public:
+		typedef T value_type;
+		typedef T *iterator;
+		typedef T *const_iterator;
+
+		Range(T *b_, T *e_) : b(b_), e(e_)
+			{}
+		template <class U>
+		Range(const Range<U> &r) : b(r.begin()), e(r.end())
+			{}
+
+		size_t size() const { return e - b; }
+		bool empty() const { return b == e; }
+		T &operator [] (size_t i) const { return b[i]; }
+		T &front() const { return *b; }
+		T &back() const { return *(e - 1); }
+		T *begin() const { return b; }
+		T *end() const { return e; }
+
+		// Conversion to a vector makes a copy
+		operator ::std::vector<int> () const
+			{ return ::std::vector<int>(b, e); }
+	};
+	typedef Range<int> range;
+	typedef Range<const int> const_range;
+
+	// List i is indices[offsets[i]] through indices[offsets[i+1]-1].
+	// Empty (no lists) if offsets is empty.
+	::std::vector<size_t> offsets;
+	::std::vector<int> indices;
+
+	// Number of lists
+	size_t size() const
+		{ return offsets.empty() ? 0 : offsets.size() - 1; }
+	bool empty() const { return offsets.empty(); }
+
+	// Total number of indices in all lists
+	size_t total() const { return indices.size(); }
+
+	// Access to list i
+	range operator [] (size_t i)
+	{
+		int *p = indices.empty() ? NULL : &indices[0];
+		return range(p + offsets[i], p + offsets[i+1]);
+	}
+	const_range operator [] (size_t i) const
+	{
+		const int *p = indices.empty() ? NULL : &indices[0];
+		return const_range(p + offsets[i], p + offsets[i+1]);
+	}
+
+	// Remove all lists, releasing storage
+	void clear()
+	{
+		::std::vector<size_t>().swap(offsets);
+		::std::vector<int>().swap(indices);
+	}
+
+	// Exchange contents with another Adjacency, without copying
+	void swap(Adjacency &a)
+	{
+		offsets.swap(a.offsets);
+		indices.swap(a.indices);
+	}
+
+	// Start building n lists, given the size of each: turns the sizes
+	// into offsets and allocates the indices.
+	void set_sizes(const ::std::vector<int> &sizes)
+	{
+		size_t n = sizes.size();
+		offsets.resize(n + 1);
+		offsets[0] = 0;
+		for (size_t i = 0; i < n; i++)
+			offsets[i+1] = offsets[i] + sizes[i];
+		indices.resize(offsets[n]);
+	}
+};
+
+} // namespace trimesh
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef BVH_H
+#define BVH_H
+/*
+BVH.h
+A bounding volume hierarchy over the faces of a triangle mesh, for
+finding the closest point on the surface to a given point, and for
+intersecting rays with the surface.
+*/
+
+#include "TriMesh.h"
+#include <vector>
+
+namespace trimesh {
+
+class BVH {
+public:
+	// A point on the surface: the face it lies on, its barycentric
+	// coordinates within that face, its position, and its squared
+	// distance from the query point.
+	struct SurfacePoint {
+		int face; // -1 if nothing was found
+		vec bary;
+		point pos;
+		float dist2;
+		SurfacePoint() : face(-1), dist2(0.0f)
+			{}
+	};
+
+	// An intersection of a ray with the surface: the face that was hit,
+	// the barycentric coordinates of the hit within that face, and the
+	// ray parameter t at which it happened.
+	struct RayHit {
+		int face; // -1 if nothing was hit
+		vec bary;
+		float t;
+		RayHit() : face(-1), t(0.0f)
+			{}
+	};
+
+private:
+	// Nodes are stored in depth-first order, so the first child of an
+	// interior node immediately follows it in the array.
+	struct Node {
+		float bmin[3], bmax[3];
+		int start; // Leaf: first triangle.  Interior: second child.
+		int ntris; // If this is 0, interior node.  If nonzero, leaf.
+	};
+
+	// Triangles are copied in leaf order, so the tree does not need
+	// the mesh once it has been built.
+	struct Tri {
+		point v[3];
+		int face;
+	};
+
+	::std::vector<Node> nodes;
+	::std::vector<Tri> tris;
+
+	// The mesh this was built from (if any), and its geometry_generation
+	// at the time, for up_to_date()
+	const TriMesh *source;
+	unsigned generation;
+
+	void build(const ::std::vector<point> &vertices,
+	           const ::std::vector<TriMesh::Face> &faces);
+	template <class Visitor>
+	void traverse_ray(const point &p, const vec &dir, float tmin,
+	                  float &tmax, Visitor &visit) const;
+	int first_hit_tri(const point &p, const vec &dir, float tmin,
+	                  float &tmax, vec &bary) const;
+	int build_node(::std::vector<int> &order, int begin, int end,
+	               const ::std::vector<box> &boxes,
+	               const ::std::vector<point> &centroids, int depth);
+
+public:
+	// Constructors from a mesh, or from lists of vertices and faces
+	BVH(TriMesh *mesh) : source(mesh), generation(0)
+	{
+		mesh->need_faces();
+		build(mesh->vertices, mesh->faces);
+		generation = mesh->geometry_generation;
+	}
+
+	BVH(const ::std::vector<point> &vertices,
+	    const ::std::vector<TriMesh::Face> &faces) :
+		source(NULL), generation(0)
+		{ build(vertices, faces); }
+
+	// Number of faces in the tree
+	size_t size() const { return tris.size(); }
+
+	// Was the tree built from this mesh, with no changes to its vertices
+	// or faces since then?
+	bool up_to_date(const TriMesh *mesh) const
+	{
+		return mesh == source &&
+		       mesh->geometry_generation == generation;
+	}
+
+	// Returns closest point on the surface to a given point p,
+	// provided it's within sqrt(maxdist2).  If maxdist2 <= 0,
+	// the search is unbounded.  Returns false (with result.face == -1)
+	// if there is no such point.
+	bool closest_pt(const point &p, SurfacePoint &result,
+	                float maxdist2 = 0.0f) const;
+
+	// Same as above, for many points at once (in parallel).
+	// Returns the number of points that found a match.
+	size_t closest_pts(const ::std::vector<point> &pts,
+	                   ::std::vector<SurfacePoint> &results,
+	                   float maxdist2 = 0.0f) const;
+
+	// Rays are p + t * dir, for tmin < t < tmax.  If tmax <= 0, rays
+	// are unbounded.  The direction need not be unit-length, in which
+	// case t is measured in units of len(dir).
+
+	// Find the first intersection along the ray.  Returns false (with
+	// hit.face == -1) if there is none.
+	bool first_hit(const point &p, const vec &dir, RayHit &hit,
+	               float tmin = 0.0f, float tmax = 0.0f) const;
+
+	// Is there any intersection along the ray?  Stops at the first
+	// one found, so this is faster than first_hit for occlusion tests.
+	bool any_hit(const point &p, const vec &dir,
+	             float tmin = 0.0f, float tmax = 0.0f) const;
+
+	// Find all intersections along the ray, sorted by t
+	void all_hits(const point &p, const vec &dir,
+	              ::std::vector<RayHit> &hits,
+	              float tmin = 0.0f, float tmax = 0.0f) const;
+
+	// Batch versions of the above, for many rays at once (in parallel).
+	// The first returns the number of rays that hit something.
+	size_t first_hits(const ::std::vector<point> &ps,
+	                  const ::std::vector<vec> &dirs,
+	                  ::std::vector<RayHit> &hits,
+	                  float tmin = 0.0f, float tmax = 0.0f) const;
+	size_t any_hits(const ::std::vector<point> &ps,
+	                const ::std::vector<vec> &dirs,
+	                ::std::vector<bool> &hit,
+	                float tmin = 0.0f, float tmax = 0.0f) const;
+
+	// Is p inside the surface?  Looks at the orientation of the first
+	// face hit by a ray from p, so the mesh should be closed and
+	// consistently oriented (with outward-facing normals).
+	bool inside(const point &p) const;
+};
+
+} // namespace trimesh
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef CORNERTABLE_H
+#define CORNERTABLE_H
+/*
+CornerTable.h
+Corner-table connectivity for a triangle mesh, with local edits (edge
+flips, splits, and collapses) that keep it valid.
+
+Corner c is vertex c % 3 of face c / 3.  For each corner, the table
+stores the opposite corner: the corner of the neighboring face that is
+across the edge facing c, or -1 if that edge is a boundary.  Edges
+shared by more than two faces, or by faces with inconsistent orientation,
+are treated as boundaries.  Corners are ints, so a mesh with more than
+INT_MAX / 3 faces gets an empty table (with an error message).
+
+Usage:
+	CornerTable ct(mesh);
+	int c = ct.corner(v);             // A corner of vertex v, or -1
+	int o = ct.opposite(c);
+	int v2 = ct.vertex(ct.next(c));   // One of v's neighbors
+	int c2 = ct.swing(c);             // Next corner around v, or -1
+
+	// Visit all the corners around v.  corner(v) is chosen so that
+	// this covers the whole fan even if v is on the boundary.
+	int c0 = ct.corner(v), c = c0;
+	while (c >= 0) {
+		...
+		c = ct.swing(c);
+		if (c == c0)
+			break;
+	}
+
+The edits modify the mesh's faces (and, for splits, add vertices), and
+call its changed_topology(), clearing its other connectivity and
+anything computed from the geometry.  Collapses leave deleted faces
+behind as Face(-1,-1,-1) until compact() is called, so that corner
+numbers stay stable during a sequence of edits.  If the faces are
+changed in any other way, the table is out of date (see up_to_date())
+and must be rebuilt before further edits.
+*/
+
+#include "TriMesh.h"
+#include <vector>
+
+namespace trimesh {
+
+class CornerTable {
+private:
+	TriMesh *mesh;
+	::std::vector<int> opp;     // Opposite corner, per corner
+	::std::vector<int> vcorner; // One corner of each vertex
+	int ndeleted;
+	unsigned generation; // mesh->topology_generation as of the last edit
+
+	void set_opp(int c, int o)
+		{ opp[c] = o; if (o >= 0) opp[o] = c; }
+	void fix_vcorner(int v, int c);
+	int find_corner(int f, int v) const;
+	void invalidate();
+
+public:
+	// Build the table for a mesh.  The table refers to the mesh, so the
+	// mesh must stay around while the table is in use.
+	CornerTable(TriMesh *mesh_);
+
+	// Has the mesh's connectivity been left alone, except through this
+	// table's own edits, since the table was built?
+	bool up_to_date() const
+		{ return mesh->topology_generation == generation; }
+
+	// Number of corners (3 * number of faces, including deleted ones)
+	int ncorners() const { return opp.size(); }
+
+	// Basic navigation
+	static int face(int c) { return c / 3; }
+	static int next(int c) { return (c % 3 == 2) ? c - 2 : c + 1; }
+	static int prev(int c) { return (c % 3 == 0) ? c + 2 : c - 1; }
+	int vertex(int c) const { return mesh->faces[c/3][c%3]; }
+	int opposite(int c) const { return opp[c]; }
+	int corner(int v) const { return vcorner[v]; }
+	bool is_deleted(int f) const { return mesh->faces[f][0] < 0; }
+
+	// The next or previous corner around vertex(c), or -1 at a boundary
+	int swing(int c) const
+		{ int o = opp[next(c)]; return (o < 0) ? -1 : next(o); }
+	int unswing(int c) const
+		{ int o = opp[prev(c)]; return (o < 0) ? -1 : prev(o); }
+
+	// Is the edge facing corner c on the boundary?
+	bool is_bdy_edge(int c) const { return opp[c] < 0; }
+
+	// Is vertex v on the boundary (or unused)?
+	bool is_bdy(int v) const
+		{ return vcorner[v] < 0 || unswing(vcorner[v]) < 0; }
+
+	// Find all the corners around v, in swing order
+	void corners_around(int v, ::std::vector<int> &corners) const;
+
+	// Flip the edge facing corner c, so that it connects vertex(c) to
+	// vertex(opposite(c)).  Returns false (and does nothing) if the edge
+	// is on the boundary or the flip would create a duplicate edge.
+	// Afterwards, c and opposite(c) face the new edge's neighbors, and
+	// next(c) faces the new edge.
+	bool flip(int c);
+
+	// Split the edge facing corner c by adding a new vertex at p,
+	// dividing each face on the edge in two.  Returns the new vertex.
+	int split(int c, const point &p);
+
+	// Collapse the edge facing corner c, merging vertex(prev(c)) into
+	// vertex(next(c)) and moving the latter to p.  Returns false (and
+	// does nothing) if the collapse would change the topology of the
+	// mesh.  Deleted faces are left in place until compact().
+	bool collapse(int c, const point &p);
+
+	// Remove the faces deleted by collapses, renumbering the corners.
+	// Vertices left unused by collapses are not removed.
+	void compact();
+};
+
+} // namespace trimesh
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef FACEKERNELS_H
+#define FACEKERNELS_H
+/*
+FaceKernels.h
+Per-face geometry (edges, cross products, lengths, corner areas, angles,
+and tangent frames), computed for a batch of faces at a time.
+
+The corners of up to FaceBatch::N faces are gathered into
+structure-of-arrays form, and each quantity is then computed by a loop
+across the batch that the compiler can turn into vector instructions.
+Each lane does exactly the same arithmetic as the scalar Vec code, so
+the results are identical to it.
+
+Functions that run the kernels on a batch should be marked FACE_KERNEL.
+With GCC or Clang on x86 with glibc, this compiles them twice: for the
+instruction set the library is built for, and for AVX2, whose registers
+hold a whole batch.  The version matching the CPU is picked when the
+library is loaded.  AVX2 does not include FMA, so both versions give the
+same results.  The kernels themselves are always inlined, so that they
+are compiled along with each version.  Elsewhere (or when building for
+AVX2 already, or with TRIMESH_NO_DISPATCH defined) there is only the one
+version.
+
+Usage:
+	FaceBatch fb;
+	for (ptrdiff_t i = 0; i < nf; i += FaceBatch::N) {
+		fb.gather(mesh->vertices, mesh->faces, i);
+		FaceBatch::Lanes n[3], a;
+		fb.cross(1, 2, n);               // Twice the area-weighted normal
+		FaceBatch::length(n, a);
+		for (int k = 0; k < fb.n; k++)
+			area[i+k] = 0.5f * a[k];
+	}
+*/
+
+#include "TriMesh.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+
+#if !defined(TRIMESH_NO_DISPATCH) && !defined(__AVX2__) && \
+    (defined(__x86_64__) || defined(__i386__)) && defined(__GLIBC__) && \
+    ((defined(__clang__) && __clang_major__ >= 14) || \
+     (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 6))
+# define FACE_KERNEL __attribute__((target_clones("avx2", "default")))
+# define FACE_INLINE inline __attribute__((always_inline))
+#else
+# define FACE_KERNEL
+# define FACE_INLINE inline
+#endif
+
+
+namespace trimesh {
+
+class FaceBatch {
+public:
+	// Number of faces per batch
+	enum { N = 8 };
+
+	// One value per face in the batch
+	typedef float Lanes[N];
+
+	// The faces in the batch are first, first+1, ..., first+n-1.  Lanes
+	// past n repeat the last face, so they hold valid (but unused) data.
+	ptrdiff_t first;
+	int n;
+
+	// Coordinate c of the vertex at corner j of each face is p[j][c]
+	Lanes p[3][3];
+
+	// The edge opposite corner j, from p[NEXT_MOD3(j)] to p[PREV_MOD3(j)],
+	// and its squared length
+	Lanes e[3][3];
+	Lanes l2[3];
+
+	// Load the faces starting at first_, and compute e and l2
+	FACE_INLINE void gather(const ::std::vector<point> &vertices,
+	            const ::std::vector<TriMesh::Face> &faces, ptrdiff_t first_)
+	{
+		first = first_;
+		n = int(::std::min(ptrdiff_t(N), ptrdiff_t(faces.size()) - first));
+		const TriMesh::Face *f = &faces[first];
+		for (int k = 0; k < N; k++) {
+			const TriMesh::Face &face = f[(k < n) ? k : n - 1];
+			const point &v0 = vertices[face[0]];
+			const point &v1 = vertices[face[1]];
+			const point &v2 = vertices[face[2]];
+			p[0][0][k] = v0[0]; p[0][1][k] = v0[1]; p[0][2][k] = v0[2];
+			p[1][0][k] = v1[0]; p[1][1][k] = v1[1]; p[1][2][k] = v1[2];
+			p[2][0][k] = v2[0]; p[2][1][k] = v2[1]; p[2][2][k] = v2[2];
+		}
+		for (int j = 0; j < 3; j++) {
+			const Lanes *from = p[NEXT_MOD3(j)], *to = p[PREV_MOD3(j)];
+#pragma omp simd
+			for (int k = 0; k < N; k++) {
+				e[j][0][k] = to[0][k] - from[0][k];
+				e[j][1][k] = to[1][k] - from[1][k];
+				e[j][2][k] = to[2][k] - from[2][k];
+				l2[j][k] = e[j][0][k] * e[j][0][k] +
+				           e[j][1][k] * e[j][1][k] +
+				           e[j][2][k] * e[j][2][k];
+			}
+		}
+	}
+
+	// out = e[a] TRICROSS e[b].  e[1] TRICROSS e[2], e[2] TRICROSS e[0],
+	// and e[0] TRICROSS e[1] are all twice the area-weighted normal,
+	// though they might differ in the last bit.
+	FACE_INLINE void cross(int a, int b, Lanes (&out)[3]) const
+	{
+		const Lanes *u = e[a], *v = e[b];
+#pragma omp simd
+		for (int k = 0; k < N; k++) {
+			out[0][k] = u[1][k] * v[2][k] - u[2][k] * v[1][k];
+			out[1][k] = u[2][k] * v[0][k] - u[0][k] * v[2][k];
+			out[2][k] = u[0][k] * v[1][k] - u[1][k] * v[0][k];
+		}
+	}
+
+	// out = len(v)
+	static FACE_INLINE void length(const Lanes (&v)[3], Lanes &out)
+	{
+#pragma omp simd
+		for (int k = 0; k < N; k++)
+			out[k] = ::std::sqrt(v[0][k] * v[0][k] +
+			                     v[1][k] * v[1][k] +
+			                     v[2][k] * v[2][k]);
+	}
+
+	// normalize(v), including its handling of zero-length vectors
+	static FACE_INLINE void normalize(Lanes (&v)[3])
+	{
+#pragma omp simd
+		for (int k = 0; k < N; k++) {
+			float l = ::std::sqrt(v[0][k] * v[0][k] +
+			                      v[1][k] * v[1][k] +
+			                      v[2][k] * v[2][k]);
+			bool ok = l > 0;
+			float il = 1 / l;
+			v[0][k] = ok ? v[0][k] * il : 0.0f;
+			v[1][k] = ok ? v[1][k] * il : 0.0f;
+			v[2][k] = ok ? v[2][k] * il : 1.0f;
+		}
+	}
+
+	// The portion of each face's area belonging to each corner, as in
+	// TriMesh::need_pointareas()
+	FACE_INLINE void cornerareas(Lanes (&ca)[3]) const
+	{
+		Lanes n[3], area;
+		cross(0, 1, n);
+		length(n, area);
+#pragma omp simd
+		for (int k = 0; k < N; k++) {
+			float a = 0.5f * area[k];
+			float l20 = l2[0][k], l21 = l2[1][k], l22 = l2[2][k];
+			float d01 = e[0][0][k] * e[1][0][k] +
+			            e[0][1][k] * e[1][1][k] +
+			            e[0][2][k] * e[1][2][k];
+			float d02 = e[0][0][k] * e[2][0][k] +
+			            e[0][1][k] * e[2][1][k] +
+			            e[0][2][k] * e[2][2][k];
+			float d12 = e[1][0][k] * e[2][0][k] +
+			            e[1][1][k] * e[2][1][k] +
+			            e[1][2][k] * e[2][2][k];
+
+			// Barycentric weights of circumcenter
+			float bcw0 = l20 * (l21 + l22 - l20);
+			float bcw1 = l21 * (l22 + l20 - l21);
+			float bcw2 = l22 * (l20 + l21 - l22);
+
+			// Obtuse at corner 0, 1, or 2
+			float o01 = -0.25f * l22 * a / d02;
+			float o02 = -0.25f * l21 * a / d01;
+			float o00 = a - o01 - o02;
+			float o12 = -0.25f * l20 * a / d01;
+			float o10 = -0.25f * l22 * a / d12;
+			float o11 = a - o12 - o10;
+			float o20 = -0.25f * l21 * a / d12;
+			float o21 = -0.25f * l20 * a / d02;
+			float o22 = a - o20 - o21;
+
+			// Acute
+			float scale = 0.5f * a / (bcw0 + bcw1 + bcw2);
+			float a0 = scale * (bcw1 + bcw2);
+			float a1 = scale * (bcw2 + bcw0);
+			float a2 = scale * (bcw0 + bcw1);
+
+			bool c0 = bcw0 <= 0.0f;
+			bool c1 = !c0 && bcw1 <= 0.0f;
+			bool c2 = !c0 && !c1 && bcw2 <= 0.0f;
+			ca[0][k] = c0 ? o00 : c1 ? o10 : c2 ? o20 : a0;
+			ca[1][k] = c0 ? o01 : c1 ? o11 : c2 ? o21 : a1;
+			ca[2][k] = c0 ? o02 : c1 ? o12 : c2 ? o22 : a2;
+		}
+	}
+
+	// The angle at each corner, as angle() in Vec.h would compute it
+	// between the two edges leaving the corner
+	FACE_INLINE void angles(Lanes (&ang)[3]) const
+	{
+		for (int j = 0; j < 3; j++) {
+			// The edges leaving corner j are e[PREV_MOD3(j)] and
+			// -e[NEXT_MOD3(j)]
+			const Lanes *u = e[PREV_MOD3(j)], *v = e[NEXT_MOD3(j)];
+			const Lanes &lu2 = l2[PREV_MOD3(j)], &lv2 = l2[NEXT_MOD3(j)];
+#pragma omp simd
+			for (int k = 0; k < N; k++) {
+				float lu = ::std::sqrt(lu2[k]), lv = ::std::sqrt(lv2[k]);
+				float x0 = u[0][k] * lv, y0 = -v[0][k] * lu;
+				float x1 = u[1][k] * lv, y1 = -v[1][k] * lu;
+				float x2 = u[2][k] * lv, y2 = -v[2][k] * lu;
+				float d0 = x0 - y0, d1 = x1 - y1, d2 = x2 - y2;
+				float s0 = x0 + y0, s1 = x1 + y1, s2 = x2 + y2;
+				ang[j][k] = 2 * ::std::atan2(
+					::std::sqrt(d0 * d0 + d1 * d1 + d2 * d2),
+					::std::sqrt(s0 * s0 + s1 * s1 + s2 * s2));
+			}
+		}
+	}
+
+	// A per-face tangent frame, as used for curvature estimation: t
+	// along e[0], and b perpendicular to it in the plane of the face
+	FACE_INLINE void frame(Lanes (&t)[3], Lanes (&b)[3]) const
+	{
+		Lanes n[3];
+		cross(0, 1, n);
+		for (int c = 0; c < 3; c++) {
+#pragma omp simd
+			for (int k = 0; k < N; k++)
+				t[c][k] = e[0][c][k];
+		}
+		normalize(t);
+#pragma omp simd
+		for (int k = 0; k < N; k++) {
+			b[0][k] = n[1][k] * t[2][k] - n[2][k] * t[1][k];
+			b[1][k] = n[2][k] * t[0][k] - n[0][k] * t[2][k];
+			b[2][k] = n[0][k] * t[1][k] - n[1][k] * t[0][k];
+		}
+		normalize(b);
+	}
+};
+
+} // namespace trimesh
+
+#endif
@@ -22,9 +22,12 @@ class KDtree {
 private:
 	struct Node;
 	struct NodeStorageBlock;
+	struct Counters;
 
 	Node *root;
 	NodeStorageBlock *storage;
+	Counters *counters; // Only used if compiled with KDTREE_STATS
+	::std::vector<float> leaf_coords; // Points in leaves, split by axis
 
 	void build(const float *ptlist, size_t n);
 	void build(const float **pts, size_t n);
@@ -37,18 +40,48 @@ public:
 		virtual ~CompatFunc() {}  // To make the compiler shut up
 	};
 
+	// Counts of the work done by a query
+	struct QueryStats {
+		size_t nodes_visited;  // Interior nodes and leaves
+		size_t leaves_visited;
+		size_t points_tested;  // Distance computations in leaves
+		size_t nodes_pruned;   // Subtrees skipped by distance bounds
+		QueryStats() : nodes_visited(0), leaves_visited(0),
+			points_tested(0), nodes_pruned(0)
+			{}
+	};
+
+	// Summary of the shape of the tree and, if the library was compiled
+	// with KDTREE_STATS defined, of the work done by all queries on it.
+	// Counting happens per query in the querying thread, and is added to
+	// that thread's own totals at the end of each query; stats() sums
+	// them over threads.  Both stats() and reset_stats() are safe to
+	// call while other threads are querying.
+	struct Stats {
+		size_t npts, nnodes, nleaves, max_depth;
+		float mean_leaf_depth;
+		// leaf_occupancy[i] is the number of leaves holding i points
+		::std::vector<size_t> leaf_occupancy;
+		size_t queries;
+		QueryStats work;
+	};
+
 	// Constructors from an array or vector of points
-	KDtree(const float *ptlist, size_t n) : root(NULL), storage(NULL)
+	KDtree(const float *ptlist, size_t n) :
+		root(NULL), storage(NULL), counters(NULL)
 		{ build(ptlist, n); }
 
-	template <class T> KDtree(const ::std::vector<T> &v) : root(NULL), storage(NULL)
+	template <class T> KDtree(const ::std::vector<T> &v) :
+		root(NULL), storage(NULL), counters(NULL)
 		{ build((const float *) &v[0], v.size()); }
 
 	// Constructors from an array or vector of pointers to points
-	KDtree(const float **pts, size_t n) : root(NULL), storage(NULL)
+	KDtree(const float **pts, size_t n) :
+		root(NULL), storage(NULL), counters(NULL)
 		{ build(pts, n); }
 
-	template <class T> KDtree(::std::vector<T *> &pts) : root(NULL), storage(NULL)
+	template <class T> KDtree(::std::vector<T *> &pts) :
+		root(NULL), storage(NULL), counters(NULL)
 		{ build((const float **) &pts[0], pts.size()); }
 
 	// Destructor - frees the whole tree
@@ -98,8 +131,43 @@ public:
 				  float approx_eps) const
 		{ return find_k_closest_to_pt(knn, k, p, maxdist2, NULL, approx_eps); }
 
+	// Find the k nearest neighbors of each of n points, stored one after
+	// another in pts.  The neighbors of point i go in knn[k*i] through
+	// knn[k*i+k-1], closest first, padded with NULL.  The queries are
+	// run in parallel, reusing one set of traversal state per thread.
+	void find_k_closest_to_pts(::std::vector<const float *> &knn,
+	                           int k,
+	                           const float *pts,
+	                           size_t n,
+	                           float maxdist2 = 0.0f,
+	                           float approx_eps = 0.0f) const;
+
+	// Bounded-work versions of closest_to_pt and find_k_closest_to_pt.
+	// These visit leaves in best-bin-first order (i.e., closest first,
+	// using a priority queue) and stop after max_leaves of them, so the
+	// cost of a query is predictable but the result may not be the
+	// true closest point(s).  If stats is non-NULL, it receives counts
+	// of the nodes visited.
+	const float *closest_to_pt_bbf(const float *p,
+	                               size_t max_leaves,
+	                               float maxdist2 = 0.0f,
+	                               const CompatFunc *iscompat = NULL,
+	                               QueryStats *stats = NULL) const;
+
+	void find_k_closest_to_pt_bbf(::std::vector<const float *> &knn,
+	                              int k,
+	                              const float *p,
+	                              size_t max_leaves,
+	                              float maxdist2 = 0.0f,
+	                              const CompatFunc *iscompat = NULL,
+	                              QueryStats *stats = NULL) const;
+
 	// Is there a point within a given distance of a query?
 	bool exists_pt_within(const float *p, float maxdist) const;
+
+	// Statistics about the tree and the queries made on it so far
+	Stats stats() const;
+	void reset_stats();
 };
 
 } // namespace trimesh
@@ -0,0 +1,223 @@
+#ifndef ONERING_H
+#define ONERING_H
+/*
+OneRing.h
+Iteration over the faces, neighbors, and edges around a vertex, in
+cyclic order.  Uses the mesh's adjacentfaces and across_edge (and, for
+edges, faceedges), which must already have been computed.  Nothing is
+allocated, and everything is inline.
+
+The faces are visited counterclockwise (seen from the front), each one
+as a corner: the face, and which of its corners is at the vertex.  If
+the vertex is on the boundary, the visit starts at the boundary, so it
+covers the whole fan.  At a non-manifold vertex, only the fan containing
+adjacentfaces[v][0] is visited.
+
+Usage:
+	mesh->need_adjacentfaces();
+	mesh->need_across_edge();
+	OneRing ring(mesh, v);
+	for (OneRing::Corner c : ring) {
+		int f = c.face;              // Faces around v, in order
+		int n = c.next;              // Neighbors, in the same order
+		...
+	}
+	for (int n : ring.vertices()) ... // All the neighbors, including
+	                                   // the last one at a boundary
+	mesh->need_edges();
+	for (int e : ring.edges()) ...     // Edges out of v, in the same order
+*/
+
+#include "TriMesh.h"
+
+namespace trimesh {
+
+class OneRing {
+public:
+	// A face around the vertex: the face, the index of the vertex
+	// within it, and the other two vertices in counterclockwise order
+	struct Corner {
+		int face, corner;
+		int next, prev;
+	};
+
+	class iterator {
+	private:
+		const TriMesh *mesh;
+		int v, f, j, f0, left;
+
+	public:
+		iterator(const TriMesh *mesh_, int v_, int f_, int j_, int left_)
+			: mesh(mesh_), v(v_), f(f_), j(j_), f0(f_), left(left_)
+			{}
+
+		Corner operator * () const
+		{
+			const TriMesh::Face &face = mesh->faces[f];
+			Corner c = { f, j, face[NEXT_MOD3(j)], face[PREV_MOD3(j)] };
+			return c;
+		}
+
+		// Cross the edge from prev to v into the next face.  Stops at
+		// the boundary, after a full turn, or if the connectivity is
+		// inconsistent.
+		iterator &operator ++ ()
+		{
+			int u = mesh->faces[f][PREV_MOD3(j)];
+			int f2 = mesh->across_edge[f][NEXT_MOD3(j)];
+			if (f2 < 0 || f2 == f0 || --left <= 0) {
+				f = -1;
+				return *this;
+			}
+			const TriMesh::Face &face2 = mesh->faces[f2];
+			for (int j2 = 0; j2 < 3; j2++) {
+				if (face2[j2] == v && face2[NEXT_MOD3(j2)] == u) {
+					f = f2;
+					j = j2;
+					return *this;
+				}
+			}
+			f = -1;
+			return *this;
+		}
+
+		bool operator == (const iterator &it) const { return f == it.f; }
+		bool operator != (const iterator &it) const { return f != it.f; }
+
+		// Is this the last face of an open fan?  (Only meaningful
+		// when the iterator is not at the end.)
+		bool at_boundary() const
+			{ return mesh->across_edge[f][NEXT_MOD3(j)] < 0; }
+	};
+
+private:
+	const TriMesh *mesh;
+	int v, f0, j0, n;
+	bool bdy;
+
+public:
+	// Find the first face around v: walk clockwise from an arbitrary
+	// face until reaching the boundary or getting back to the start
+	OneRing(const TriMesh *mesh_, int v_)
+		: mesh(mesh_), v(v_), f0(-1), j0(-1), n(0), bdy(false)
+	{
+		Adjacency::const_range a = mesh->adjacentfaces[v];
+		n = a.size();
+		if (!n)
+			return;
+		int f = a[0], j = mesh->faces[f].indexof(v);
+		for (int steps = 0; steps < n; steps++) {
+			int w = mesh->faces[f][NEXT_MOD3(j)];
+			int f2 = mesh->across_edge[f][PREV_MOD3(j)];
+			if (f2 < 0) {
+				bdy = true;
+				break;
+			}
+			if (f2 == a[0])
+				break;
+			int j2 = -1;
+			const TriMesh::Face &face2 = mesh->faces[f2];
+			for (int k = 0; k < 3; k++) {
+				if (face2[k] == v && face2[PREV_MOD3(k)] == w) {
+					j2 = k;
+					break;
+				}
+			}
+			if (j2 < 0) {
+				bdy = true;
+				break;
+			}
+			f = f2;
+			j = j2;
+		}
+		f0 = f;
+		j0 = j;
+	}
+
+	iterator begin() const
+		{ return iterator(mesh, v, f0, j0, n); }
+	iterator end() const
+		{ return iterator(mesh, v, -1, -1, 0); }
+
+	// Is v on the boundary (that is, is its fan open)?
+	bool is_bdy() const { return bdy; }
+
+
+	// The "spokes" out of v, in order: the neighboring vertices, or the
+	// edges to them (as indices into mesh->edges).  An open fan has one
+	// more spoke than it has faces, from the last face's prev vertex.
+	template <bool EDGES>
+	class spoke_iterator {
+	private:
+		const TriMesh *mesh;
+		iterator it, e;
+		int extra;
+
+		int first_spoke(const Corner &c) const
+		{
+			return EDGES ? mesh->faceedges[c.face][PREV_MOD3(c.corner)] :
+			               c.next;
+		}
+		int last_spoke(const Corner &c) const
+		{
+			return EDGES ? mesh->faceedges[c.face][NEXT_MOD3(c.corner)] :
+			               c.prev;
+		}
+
+	public:
+		spoke_iterator(const TriMesh *mesh_, const iterator &it_,
+		               const iterator &e_)
+			: mesh(mesh_), it(it_), e(e_), extra(-1)
+			{}
+		int operator * () const
+			{ return (it != e) ? first_spoke(*it) : extra; }
+		spoke_iterator &operator ++ ()
+		{
+			if (it == e) {
+				extra = -1;
+				return *this;
+			}
+			Corner c = *it;
+			bool last = it.at_boundary();
+			++it;
+			if (it == e && last)
+				extra = last_spoke(c);
+			return *this;
+		}
+		bool operator == (const spoke_iterator &x) const
+			{ return it == x.it && extra == x.extra; }
+		bool operator != (const spoke_iterator &x) const
+			{ return !(*this == x); }
+	};
+	typedef spoke_iterator<false> vertex_iterator;
+	typedef spoke_iterator<true> edge_iterator;
+
+	template <class It>
+	class Range {
+	private:
+		It b, e;
+
+	public:
+		Range(const It &b_, const It &e_) : b(b_), e(e_)
+			{}
+		It begin() const { return b; }
+		It end() const { return e; }
+	};
+
+	Range<vertex_iterator> vertices() const
+	{
+		return Range<vertex_iterator>(
+			vertex_iterator(mesh, begin(), end()),
+			vertex_iterator(mesh, end(), end()));
+	}
+	Range<edge_iterator> edges() const
+	{
+		return Range<edge_iterator>(
+			edge_iterator(mesh, begin(), end()),
+			edge_iterator(mesh, end(), end()));
+	}
+};
+
+} // namespace trimesh
+
+#endif
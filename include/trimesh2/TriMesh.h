@@ -11,6 +11,8 @@ Class for triangle meshes.
 #include "Vec.h"
 #include "Box.h"
 #include "Color.h"
+#include "Adjacency.h"
+#include "Accumulate.h"
 #include "strutil.h"
 #include <vector>
 #include <cstdint>
@@ -28,6 +30,11 @@ static inline void clear_and_release(::std::vector<T> &v)
 	::std::vector<T>().swap(v);
 }
 
+static inline void clear_and_release(Adjacency &a)
+{
+	a.clear();
+}
+
 typedef struct Material {
     
     std::string name;
@@ -52,6 +59,7 @@ public:
 	// Types
 	//
 	typedef Vec<3,int> Face;
+	typedef Vec<2,int> Edge;
 	typedef Box<3,float> BBox;
 
 	struct BSphere {
@@ -74,11 +82,20 @@ public:
 		STAT_MEDIAN, STAT_STDEV };
 	enum StatVal { STAT_VALENCE, STAT_FACEAREA, STAT_ANGLE,
 		STAT_DIHEDRAL, STAT_EDGELEN, STAT_X, STAT_Y, STAT_Z };
+	enum NeedWhat {
+		NEED_FACES = 1 << 0, NEED_NORMALS = 1 << 1,
+		NEED_CURVATURES = 1 << 2, NEED_DCURV = 1 << 3,
+		NEED_POINTAREAS = 1 << 4, NEED_FACENORMALS = 1 << 5,
+		NEED_FACEAREAS = 1 << 6, NEED_BBOX = 1 << 7,
+		NEED_BSPHERE = 1 << 8, NEED_NEIGHBORS = 1 << 9,
+		NEED_ADJACENTFACES = 1 << 10, NEED_ACROSS_EDGE = 1 << 11,
+		NEED_EDGES = 1 << 12, NEED_BOUNDARY_LOOPS = 1 << 13 };
 
 	//
 	// Constructor
 	//
-	TriMesh() : grid_width(-1), grid_height(-1), flag_curr(0)
+	TriMesh() : grid_width(-1), grid_height(-1), flag_curr(0),
+		geometry_generation(0), topology_generation(0)
 		{}
 
 	//
@@ -113,19 +130,41 @@ public:
 	::std::vector<vec> cornerareas;
 	::std::vector<float> pointareas;
 
+	// Computed per-face properties: unit normals, and areas.  These are
+	// discarded by clear_normals() along with the vertex normals.
+	::std::vector<vec> facenormals;
+	::std::vector<float> faceareas;
+
 	// Bounding structures
 	BBox bbox;
 	BSphere bsphere;
 
 	// Connectivity structures:
-	//  For each vertex, all neighboring vertices
-	::std::vector< ::std::vector<int> > neighbors;
-	//  For each vertex, all neighboring faces
-	::std::vector< ::std::vector<int> > adjacentfaces;
+	//  For each vertex, all neighboring vertices (sorted)
+	Adjacency neighbors;
+	//  For each vertex, all neighboring faces (sorted)
+	Adjacency adjacentfaces;
 	//  For each face, the three faces attached to its edges
 	//  (for example, across_edge[3][2] is the number of the face
 	//   that's touching the edge opposite vertex 2 of face 3)
 	::std::vector<Face> across_edge;
+	//  All the edges, as pairs of vertices (lower-numbered first),
+	//  sorted, and for each face the edges opposite each vertex
+	//  (for example, edges[faceedges[3][2]] is the edge opposite
+	//   vertex 2 of face 3)
+	::std::vector<Edge> edges;
+	::std::vector<Face> faceedges;
+	//  The boundary loops, each given as its vertices in order.  Loops
+	//  go in the same direction as the faces along them (so, clockwise
+	//  around a hole when seen from the front of the surface).
+	Adjacency boundary_loops;
+
+	// Change counters.  geometry_generation goes up whenever vertices
+	// move, and topology_generation (along with geometry_generation)
+	// whenever faces change or vertices are added or removed, so that
+	// structures built from the mesh can check whether they are out of
+	// date (see BVH::up_to_date() and CornerTable::up_to_date()).
+	unsigned geometry_generation, topology_generation;
 
     Material material;
 	//
@@ -152,27 +191,66 @@ public:
 	}
 	void triangulate_grid(bool remove_slivers = true);
 	void need_normals(bool simple_area_weighted = false);
+	// Normals for a point cloud, ignoring any faces: fits a plane to the
+	// k nearest neighbors of each point that are within maxdist (if it is
+	// nonzero).  The normals are turned toward the viewpoint if one is
+	// given, and otherwise oriented consistently with their neighbors.
+	// need_normals() calls this, with the defaults, if there are no faces.
+	void need_point_normals(int k = 10, float maxdist = 0.0f,
+	                        const point *viewpoint = NULL);
 	void need_curvatures();
+	// Curvatures for a point cloud, ignoring any faces: fits a quadric
+	// height field over the tangent plane to the k nearest neighbors of
+	// each point that are within maxdist (if it is nonzero).
+	// need_curvatures() calls this, with the defaults, if there are no
+	// faces.
+	void need_point_curvatures(int k = 20, float maxdist = 0.0f);
 	void need_dcurv();
 	void need_pointareas();
+	void need_facenormals();
+	void need_faceareas();
 	void need_bbox();
 	void need_bsphere();
 	void need_neighbors();
 	void need_adjacentfaces();
 	void need_across_edge();
+	void need_edges();
+	void need_boundary_loops();
+
+	// Compute several of the above at once: what is a combination of
+	// NEED_* flags.  Whatever those depend on is computed as well, and
+	// quantities that do not depend on each other may be computed
+	// concurrently, when there are enough of them to keep all the
+	// threads busy.
+	void need(unsigned what);
+
+	// Find edges shared by more than two faces, and edges shared by two
+	// faces with inconsistent orientation.  Each edge is given as its two
+	// vertices, lower-numbered first.  Also builds across_edge if needed.
+	void find_bad_edges(::std::vector<Edge> &nonmanifold,
+	                    ::std::vector<Edge> &misoriented);
+
+	// Update the connectivity for the removal of some faces, given the
+	// new number of each face (or -1 if it is being removed).  Called by
+	// remove_faces() before it removes the faces themselves.
+	void patch_connectivity(const ::std::vector<int> &face_remap);
 
 	//
 	// Delete everything and release storage
 	//
 	void clear_vertices()      { clear_and_release(vertices); }
-	void clear_faces()         { clear_and_release(faces); }
+	void clear_faces()         { clear_and_release(faces);
+	                             clear_and_release(facenormals);
+	                             clear_and_release(faceareas); }
 	void clear_tstrips()       { clear_and_release(tstrips); }
 	void clear_grid()          { clear_and_release(grid);
 	                             grid_width = grid_height = -1;}
 	void clear_colors()        { clear_and_release(colors); }
 	void clear_confidences()   { clear_and_release(confidences); }
 	void clear_flags()         { clear_and_release(flags); flag_curr = 0; }
-	void clear_normals()       { clear_and_release(normals); }
+	void clear_normals()       { clear_and_release(normals);
+	                             clear_and_release(facenormals);
+	                             clear_and_release(faceareas); }
 	void clear_curvatures()    { clear_and_release(pdir1);
 	                             clear_and_release(pdir2);
 	                             clear_and_release(curv1);
@@ -180,18 +258,54 @@ public:
 	void clear_dcurv()         { clear_and_release(dcurv); }
 	void clear_pointareas()    { clear_and_release(pointareas);
 	                             clear_and_release(cornerareas); }
+	void clear_facenormals()   { clear_and_release(facenormals); }
+	void clear_faceareas()     { clear_and_release(faceareas); }
 	void clear_bbox()          { bbox.clear(); }
 	void clear_bsphere()       { bsphere.valid = false; }
 	void clear_neighbors()     { clear_and_release(neighbors); }
 	void clear_adjacentfaces() { clear_and_release(adjacentfaces); }
 	void clear_across_edge()   { clear_and_release(across_edge); }
+	void clear_edges()         { clear_and_release(edges);
+	                             clear_and_release(faceedges); }
+	void clear_boundary_loops() { clear_and_release(boundary_loops); }
 	void clear()
 	{
 		clear_vertices(); clear_faces(); clear_tstrips(); clear_grid();
 		clear_colors(); clear_confidences(); clear_flags();
 		clear_normals(); clear_curvatures(); clear_dcurv();
-		clear_pointareas(); clear_bbox(); clear_bsphere();
+		clear_pointareas(); clear_facenormals(); clear_faceareas();
+		clear_bbox(); clear_bsphere();
+		clear_neighbors(); clear_adjacentfaces(); clear_across_edge();
+		clear_edges(); clear_boundary_loops();
+	}
+
+	// Release memory allocated beyond what each member currently needs,
+	// for example after reading a file or removing vertices or faces
+	void shrink_to_fit();
+
+	//
+	// Call these after modifying the mesh directly, to throw away
+	// anything computed from the old version.
+	//
+	// After moving vertices: discards normals, curvatures, point and
+	// face areas, face normals, and bounding volumes, but keeps
+	// connectivity.
+	void changed_geometry()
+	{
+		geometry_generation++;
+		clear_normals(); clear_curvatures(); clear_dcurv();
+		clear_pointareas(); clear_facenormals(); clear_faceareas();
+		clear_bbox(); clear_bsphere();
+	}
+	// After changing faces, or adding or removing vertices: discards
+	// all of the above, plus connectivity.  Triangle strips and grids
+	// are left alone, since they might be what was changed.
+	void changed_topology()
+	{
+		topology_generation++;
+		changed_geometry();
 		clear_neighbors(); clear_adjacentfaces(); clear_across_edge();
+		clear_edges(); clear_boundary_loops();
 	}
 
 	//
@@ -253,7 +367,7 @@ public:
 		const point &p0 = vertices[faces[i][j]];
 		const point &p1 = vertices[faces[i][NEXT_MOD3(j)]];
 		const point &p2 = vertices[faces[i][PREV_MOD3(j)]];
-		return acos((p1 - p0) DOT (p2 - p0));
+		return angle(p1 - p0, p2 - p0);
 	}
 
 	// Dihedral angle between face i and face across_edge[i][j]
@@ -261,8 +375,10 @@ public:
 	{
 		if (unlikely(across_edge.empty())) need_across_edge();
 		if (unlikely(across_edge[i][j] < 0)) return 0.0f;
-		vec mynorm = trinorm(i);
-		vec othernorm = trinorm(across_edge[i][j]);
+		if (unlikely(facenormals.size() != faces.size()))
+			need_facenormals();
+		const vec &mynorm = facenormals[i];
+		const vec &othernorm = facenormals[across_edge[i][j]];
 		float ang = angle(mynorm, othernorm);
 		vec towards = 0.5f * (vertices[faces[i][NEXT_MOD3(j)]] +
 		                      vertices[faces[i][PREV_MOD3(j)]]) -
@@ -273,10 +389,21 @@ public:
 			return M_PIf - ang;
 	}
 
-	// Statistics
-	float stat(StatOp op, StatVal val);
+	// Length of boundary loop i, and area of the polygon it outlines
+	// (the magnitude of its vector area)
+	float boundary_loop_length(int i);
+	float boundary_loop_area(int i);
+
+	// Statistics.  Sums (for STAT_SUM through STAT_RMS, and STAT_STDEV)
+	// are computed in parallel, with the given accumulation policy.
+	float stat(StatOp op, StatVal val, SumMode mode = SUM_DOUBLE);
 	float feature_size();
 
+	// Memory used by the mesh, in bytes.  If breakdown is not NULL, it
+	// is filled in with the name and size of each member that uses any.
+	typedef ::std::pair<const char *, size_t> MemoryItem;
+	size_t memory_usage(::std::vector<MemoryItem> *breakdown = NULL) const;
+
 	//
 	// Debugging
 	//
@@ -96,6 +96,31 @@ extern void proj_dcurv(const vec &old_u, const vec &old_v,
                        const vec &new_u, const vec &new_v,
                        Vec<4> &new_dcurv);
 
+// A feature line, given as its points in order.  A closed line repeats
+// its first point at the end.
+typedef ::std::vector<point> FeatureLine;
+
+// Find ridge lines (or valley lines, if valleys is true): the places
+// where the larger-magnitude principal curvature is at a maximum (or
+// minimum) along its principal direction.  Only segments where the
+// magnitude of that curvature is at least thresh are kept.  Computes
+// curvatures and their derivatives if they are not already present.
+extern void find_ridges(TriMesh *mesh, bool valleys, float thresh,
+                        ::std::vector<FeatureLine> &lines);
+
+// As above, for each of the given smoothing scales: the curvatures and
+// their derivatives are diffused with each sigma (no smoothing if it is
+// zero), and lines[i] gets the lines found at sigmas[i].  The mesh's
+// own curvatures are left unsmoothed.
+extern void find_ridges_multiscale(TriMesh *mesh, bool valleys, float thresh,
+                                   const ::std::vector<float> &sigmas,
+                                   ::std::vector< ::std::vector<FeatureLine> > &lines);
+
+// Find sharp creases: chains of edges across which the face normals
+// differ by more than the given angle (in radians)
+extern void find_creases(TriMesh *mesh, float angle,
+                         ::std::vector<FeatureLine> &lines);
+
 // Create an offset surface from a mesh
 extern void inflate(TriMesh *mesh, float amount);
 
@@ -120,17 +145,22 @@ extern void scale(TriMesh *mesh, float s, const vec &d);
 // Clip mesh to the given bounding box
 extern void clip(TriMesh *mesh, const box &b);
 
-// Find center of mass of a bunch of points
-extern point point_center_of_mass(const ::std::vector<point> &pts);
+// Find center of mass of a bunch of points.  The sums in this and the
+// following functions are computed in parallel, with the given
+// accumulation policy (see Accumulate.h).
+extern point point_center_of_mass(const ::std::vector<point> &pts,
+                                  SumMode mode = SUM_DOUBLE);
 
 // Find (area-weighted) center of mass of a mesh
-extern point mesh_center_of_mass(TriMesh *mesh);
+extern point mesh_center_of_mass(TriMesh *mesh, SumMode mode = SUM_DOUBLE);
 
 // Compute covariance of a bunch of points
-extern void point_covariance(const ::std::vector<point> &pts, float (&C)[3][3]);
+extern void point_covariance(const ::std::vector<point> &pts, float (&C)[3][3],
+                             SumMode mode = SUM_DOUBLE);
 
 // Compute covariance of faces (area-weighted) in a mesh
-extern void mesh_covariance(TriMesh *mesh, float (&C)[3][3]);
+extern void mesh_covariance(TriMesh *mesh, float (&C)[3][3],
+                            SumMode mode = SUM_DOUBLE);
 
 // Scale the mesh so that mean squared distance from center of mass is 1
 extern void normalize_variance(TriMesh *mesh);
@@ -179,6 +209,24 @@ extern void select_small_comps(TriMesh *mesh, const ::std::vector<int> &comps,
 	const ::std::vector<int> &compsizes, int max_size,
 	int total_smallest = ::std::numeric_limits<int>::max());
 
+// Mass properties of the solid bounded by a closed mesh, with unit
+// density.  The volume is negative if the mesh is inside out; the
+// centroid and inertia tensor (about the centroid) are those of the solid
+// either way.
+struct MassProperties {
+	double volume, area;
+	dvec3 centroid;
+	double inertia[3][3];
+};
+
+// Find the mass properties of a mesh
+extern MassProperties mesh_mass_properties(TriMesh *mesh);
+
+// Find the mass properties of each connected component, given the output
+// of find_comps()
+extern void comp_mass_properties(TriMesh *mesh, const ::std::vector<int> &comps,
+	const ::std::vector<int> &compsizes, ::std::vector<MassProperties> &props);
+
 // Find overlap area and RMS distance between mesh1 and mesh2.
 // rmsdist is unchanged if area returned as zero
 extern void find_overlap(TriMesh *mesh1, TriMesh *mesh2,
@@ -0,0 +1,164 @@
+#ifndef VERTEXBLOCKS_H
+#define VERTEXBLOCKS_H
+/*
+VertexBlocks.h
+Helpers for computing per-vertex quantities from the faces in parallel,
+without changing the results.
+
+The corners of the faces are bucketed by vertex, and the contributions
+of the corners (computed beforehand, in parallel over the faces) are
+then added up in parallel over the vertices.  Each vertex's corners are
+visited in face order by a single thread, exactly as if they had been
+accumulated by a serial loop over the faces, so the results are the
+same, to the bit, for any number of threads.
+*/
+
+#include "TriMesh.h"
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace trimesh {
+
+#ifdef _OPENMP
+// How many threads a parallel region started here would get.  Inside
+// TriMesh::need() this is the size of the current sub-team, and it is 1
+// where the region could not be active.
+static inline int team_threads()
+{
+	if (omp_get_active_level() >= omp_get_max_active_levels())
+		return 1;
+	return omp_get_max_threads();
+}
+#endif
+
+
+// Increment a counter, returning its old value.  Only a counter that
+// other threads might be updating needs the (slower) atomic add.
+static inline size_t bump_count(::std::atomic<size_t> &c, bool shared)
+{
+	if (shared)
+		return c.fetch_add(1, ::std::memory_order_relaxed);
+	size_t n = c.load(::std::memory_order_relaxed);
+	c.store(n + 1, ::std::memory_order_relaxed);
+	return n;
+}
+
+
+// Counting sort of per-corner entries into per-vertex buckets, in
+// parallel over the faces.  For corner j of face i, emit(i, j, v, x)
+// fills in up to K vertices v[k] and entries x[k] to go in their buckets,
+// and returns how many; it is called twice for each corner, and must give
+// the same answer both times.  Afterwards, the bucket of vertex v is
+// entries[offsets[v]] through entries[offsets[v+1]-1], sorted, so the
+// result does not depend on the order in which the threads got there.
+template <class T, int K, class Emit>
+static inline void bucket_by_vertex(const ::std::vector<TriMesh::Face> &faces,
+                                    ptrdiff_t nv,
+                                    ::std::vector<size_t> &offsets,
+                                    ::std::vector<T> &entries, Emit emit)
+{
+	ptrdiff_t nf = faces.size();
+	bool shared = false;
+#ifdef _OPENMP
+	shared = team_threads() > 1;
+#endif
+	::std::vector< ::std::atomic<size_t> > count(nv);
+#pragma omp parallel for if (shared)
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			int v[K];
+			T x[K];
+			int n = emit(i, j, v, x);
+			for (int k = 0; k < n; k++)
+				bump_count(count[v[k]], shared);
+		}
+	}
+
+	// Turn the counts into offsets, leaving count[v] as the next free
+	// spot in bucket v
+	offsets.resize(nv + 1);
+	offsets[0] = 0;
+	for (ptrdiff_t v = 0; v < nv; v++) {
+		offsets[v+1] = offsets[v] + count[v].load(::std::memory_order_relaxed);
+		count[v].store(offsets[v], ::std::memory_order_relaxed);
+	}
+
+	entries.resize(offsets[nv]);
+#pragma omp parallel for if (shared)
+	for (ptrdiff_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			int v[K];
+			T x[K];
+			int n = emit(i, j, v, x);
+			for (int k = 0; k < n; k++)
+				entries[bump_count(count[v[k]], shared)] = x[k];
+		}
+	}
+
+#pragma omp parallel for schedule(dynamic,1024) if (shared)
+	for (ptrdiff_t v = 0; v < nv; v++) {
+		if (offsets[v+1] - offsets[v] > 1)
+			::std::sort(entries.begin() + offsets[v],
+			            entries.begin() + offsets[v+1]);
+	}
+}
+
+
+// The corners of each vertex, as 3 * face + corner, in increasing (and
+// therefore face) order: those of vertex v are corners[offsets[v]]
+// through corners[offsets[v+1]-1].  With only one thread, these are not
+// built, and for_each() just loops over the faces.
+class VertexCorners {
+private:
+	const ::std::vector<TriMesh::Face> &faces;
+
+public:
+	::std::vector<size_t> offsets;
+	::std::vector<ptrdiff_t> corners;
+
+	VertexCorners(const ::std::vector<TriMesh::Face> &faces_, ptrdiff_t nv) :
+		faces(faces_)
+	{
+#ifdef _OPENMP
+		if (team_threads() == 1)
+			return;
+		bucket_by_vertex<ptrdiff_t, 1>(faces, nv, offsets, corners,
+			[&](ptrdiff_t i, int j, int *v, ptrdiff_t *c) -> int {
+				v[0] = faces[i][j];
+				c[0] = 3 * i + j;
+				return 1;
+			});
+#else
+		(void) nv;
+#endif
+	}
+
+	// Call f(v, i, j) for each corner j of each face i, where v is the
+	// vertex at that corner, in parallel over the vertices.  All the
+	// corners of any one vertex are visited in order by the same thread.
+	template <class Func>
+	void for_each(Func f) const
+	{
+		if (offsets.empty()) {
+			ptrdiff_t nf = faces.size();
+			for (ptrdiff_t i = 0; i < nf; i++)
+				for (int j = 0; j < 3; j++)
+					f(faces[i][j], i, j);
+			return;
+		}
+		ptrdiff_t nv = offsets.size() - 1;
+#pragma omp parallel for
+		for (ptrdiff_t v = 0; v < nv; v++) {
+			for (size_t k = offsets[v]; k < offsets[v+1]; k++)
+				f(v, corners[k] / 3, int(corners[k] % 3));
+		}
+	}
+};
+
+} // namespace trimesh
+
+#endif
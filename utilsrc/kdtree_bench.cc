@@ -0,0 +1,246 @@
+/*
+kdtree_bench.cc
+Time KDtree construction and queries on synthetic point clouds and/or the
+vertices of meshes, and print statistics about the trees.
+
+The per-query work counters are only filled in if the library was
+compiled with KDTREE_STATS defined.
+*/
+
+#include "TriMesh.h"
+#include "KDtree.h"
+#include "timestamp.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+using namespace std;
+using namespace trimesh;
+
+
+void usage(const char *myname)
+{
+	fprintf(stderr, "Usage: %s [options] [infile...]\n", myname);
+	fprintf(stderr, "\nOptions:\n");
+	fprintf(stderr, "	-n npts		Points in synthetic clouds (default 1000000)\n");
+	fprintf(stderr, "	-q nqueries	Queries of each type (default 100000)\n");
+	fprintf(stderr, "	-k k		Neighbors for k-NN queries (default 8)\n");
+	fprintf(stderr, "	-eps eps	Approximation epsilon (default 0)\n");
+	fprintf(stderr, "	-leaves n	Also run best-bin-first queries visiting n leaves\n");
+	fprintf(stderr, "	-nosynth	Skip the synthetic clouds\n");
+	fprintf(stderr, "\nSynthetic clouds are a uniform cube, a noisy plane, and\n");
+	fprintf(stderr, "tight clusters with sparse outliers.\n");
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+
+// Synthetic clouds
+static void make_cube(vector<point> &pts, int n)
+{
+	pts.resize(n);
+	for (int i = 0; i < n; i++)
+		pts[i] = point(uniform_rnd(), uniform_rnd(), uniform_rnd());
+}
+
+static void make_plane(vector<point> &pts, int n)
+{
+	pts.resize(n);
+	for (int i = 0; i < n; i++)
+		pts[i] = point(uniform_rnd(), uniform_rnd(), normal_rnd(1.0e-4f));
+}
+
+static void make_clusters(vector<point> &pts, int n)
+{
+	const int nclusters = 20;
+	vector<point> centers(nclusters);
+	for (int i = 0; i < nclusters; i++)
+		centers[i] = point(uniform_rnd(), uniform_rnd(), uniform_rnd());
+
+	pts.resize(n);
+	for (int i = 0; i < n; i++) {
+		if (uniform_rnd() < 0.001f) {
+			pts[i] = point(uniform_rnd(100.0f), uniform_rnd(100.0f),
+			               uniform_rnd(100.0f));
+			continue;
+		}
+		const point &c = centers[uniform_rnd(nclusters)];
+		pts[i] = c + 0.01f * vec(normal_rnd(1.0f), normal_rnd(1.0f),
+		                         normal_rnd(1.0f));
+	}
+}
+
+
+// Print the shape of the tree, and (if counted) the work done since
+// the last reset
+static void print_stats(const KDtree &kd, bool structure)
+{
+	KDtree::Stats s = kd.stats();
+	if (structure) {
+		printf("  %lu points, %lu nodes, %lu leaves, depth %lu "
+		       "(mean leaf depth %.1f)\n",
+		       (unsigned long) s.npts, (unsigned long) s.nnodes,
+		       (unsigned long) s.nleaves, (unsigned long) s.max_depth,
+		       s.mean_leaf_depth);
+		printf("  Leaf occupancy:");
+		for (size_t i = 1; i < s.leaf_occupancy.size(); i++)
+			printf(" %lu:%.1f%%", (unsigned long) i,
+			       100.0f * s.leaf_occupancy[i] / s.nleaves);
+		printf("\n");
+		return;
+	}
+	if (!s.queries)
+		return;
+	double q = s.queries;
+	size_t considered = s.work.nodes_visited + s.work.nodes_pruned;
+	printf("      per query: %.1f nodes, %.1f leaves, %.1f points, "
+	       "%.0f%% pruned\n",
+	       s.work.nodes_visited / q, s.work.leaves_visited / q,
+	       s.work.points_tested / q,
+	       considered ? 100.0 * s.work.nodes_pruned / considered : 0.0);
+}
+
+
+// Time all the query types on one cloud
+static void bench(const char *name, const vector<point> &pts,
+                  int nqueries, int k, float eps, int leaves)
+{
+	printf("%s:\n", name);
+	if (pts.empty())
+		return;
+
+	timestamp t = now();
+	KDtree kd(pts);
+	printf("  Build: %.3f sec.\n", now() - t);
+	print_stats(kd, true);
+
+	// Queries near the data: random points, jittered by roughly the
+	// typical spacing between points
+	box bbox;
+	for (size_t i = 0; i < pts.size(); i++)
+		bbox += pts[i];
+	float jitter = len(bbox.size()) / cbrt(float(pts.size()));
+	vector<point> q(nqueries);
+	vector<vec> dirs(nqueries);
+	for (int i = 0; i < nqueries; i++) {
+		q[i] = pts[uniform_rnd(pts.size())] +
+		       vec(normal_rnd(jitter), normal_rnd(jitter),
+		           normal_rnd(jitter));
+		dirs[i] = vec(normal_rnd(1.0f), normal_rnd(1.0f),
+		              normal_rnd(1.0f));
+	}
+
+	int found = 0;
+	kd.reset_stats();
+	t = now();
+	for (int i = 0; i < nqueries; i++)
+		if (kd.closest_to_pt(q[i], 0.0f, eps))
+			found++;
+	printf("    closest_to_pt:  %.3f usec/query (%d found)\n",
+	       1.0e6f * (now() - t) / nqueries, found);
+	print_stats(kd, false);
+
+	vector<const float *> knn;
+	kd.reset_stats();
+	t = now();
+	for (int i = 0; i < nqueries; i++)
+		kd.find_k_closest_to_pt(knn, k, q[i], 0.0f, eps);
+	printf("    k-NN (k = %d):  %.3f usec/query\n",
+	       k, 1.0e6f * (now() - t) / nqueries);
+	print_stats(kd, false);
+
+	// Ray queries are much more expensive - do fewer
+	int nrays = max(nqueries / 100, 1);
+	found = 0;
+	kd.reset_stats();
+	t = now();
+	for (int i = 0; i < nrays; i++)
+		if (kd.closest_to_ray(q[i], dirs[i], 0.0f, eps))
+			found++;
+	printf("    closest_to_ray: %.3f usec/query (%d found)\n",
+	       1.0e6f * (now() - t) / nrays, found);
+	print_stats(kd, false);
+
+	found = 0;
+	kd.reset_stats();
+	t = now();
+	for (int i = 0; i < nqueries; i++)
+		if (kd.exists_pt_within(q[i], jitter))
+			found++;
+	printf("    exists_pt:      %.3f usec/query (%d found)\n",
+	       1.0e6f * (now() - t) / nqueries, found);
+	print_stats(kd, false);
+
+	if (leaves <= 0)
+		return;
+
+	KDtree::QueryStats qs;
+	size_t maxleaves = 0;
+	kd.reset_stats();
+	t = now();
+	for (int i = 0; i < nqueries; i++) {
+		kd.closest_to_pt_bbf(q[i], leaves, 0.0f, NULL, &qs);
+		maxleaves = max(maxleaves, qs.leaves_visited);
+	}
+	printf("    closest_to_pt_bbf (%d leaves): %.3f usec/query "
+	       "(max %lu leaves)\n", leaves,
+	       1.0e6f * (now() - t) / nqueries, (unsigned long) maxleaves);
+	print_stats(kd, false);
+}
+
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+
+	int npts = 1000000, nqueries = 100000, k = 8, leaves = 0;
+	float eps = 0.0f;
+	bool synth = true;
+	vector<const char *> filenames;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			npts = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-q") && i + 1 < argc)
+			nqueries = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+			k = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-eps") && i + 1 < argc)
+			eps = (float) atof(argv[++i]);
+		else if (!strcmp(argv[i], "-leaves") && i + 1 < argc)
+			leaves = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-nosynth"))
+			synth = false;
+		else if (argv[i][0] == '-')
+			usage(argv[0]);
+		else
+			filenames.push_back(argv[i]);
+	}
+	if (npts < 1 || nqueries < 1 || k < 1)
+		usage(argv[0]);
+
+	// Consistent results from run to run
+	xorshift_rnd(0);
+
+	vector<point> pts;
+	if (synth) {
+		make_cube(pts, npts);
+		bench("Uniform cube", pts, nqueries, k, eps, leaves);
+		make_plane(pts, npts);
+		bench("Noisy plane", pts, nqueries, k, eps, leaves);
+		make_clusters(pts, npts);
+		bench("Clusters with outliers", pts, nqueries, k, eps, leaves);
+	}
+
+	for (size_t i = 0; i < filenames.size(); i++) {
+		TriMesh *mesh = TriMesh::read(filenames[i]);
+		if (!mesh) {
+			TriMesh::eprintf("Couldn't read %s\n", filenames[i]);
+			continue;
+		}
+		bench(filenames[i], mesh->vertices, nqueries, k, eps, leaves);
+		delete mesh;
+	}
+
+	return 0;
+}
@@ -242,8 +242,7 @@ int main(int argc, char *argv[])
 			for (size_t v = 0; v < themesh->vertices.size(); v++)
 				themesh->vertices[v] += 2.0f *
 					(origverts[v] - themesh->vertices[v]);
-			themesh->pointareas.clear();
-			themesh->normals.clear();
+			themesh->changed_geometry();
 		} else if (!strcmp(argv[i], "-smoothnorm")) {
 			i++;
 			if (!(i < argc && isanumber(argv[i]))) {
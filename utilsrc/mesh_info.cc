@@ -34,6 +34,7 @@ void usage(const char *myname)
 	fprintf(stderr, "	face_stdev	Standard deviation of faces around mean\n");
 	fprintf(stderr, "	overlap infile2	Overlap area and RMS distance to other mesh\n");
 	fprintf(stderr, "	iou infile2	Intersection-over-union area with other mesh\n");
+	fprintf(stderr, "	memory		Memory used by each part of the mesh, in bytes\n");
 	fprintf(stderr, "\nStatistical operations:\n");
 	fprintf(stderr, "	min		Minimum\n");
 	fprintf(stderr, "	minabs		Minimum absolute value\n");
@@ -139,6 +140,14 @@ int main(int argc, char *argv[])
 		mesh_covariance(mesh, C);
 		printf("%g\n", sqrt(C[0][0] + C[1][1] + C[2][2]));
 		return 0;
+	} else if (!strcmp(info_type, "memory")) {
+		vector<TriMesh::MemoryItem> items;
+		size_t total = mesh->memory_usage(&items);
+		for (size_t i = 0; i < items.size(); i++)
+			printf("%-15s %lu\n", items[i].first,
+				(unsigned long) items[i].second);
+		printf("%-15s %lu\n", "total", (unsigned long) total);
+		return 0;
 	} else if (!strcmp(info_type, "overlap") && info_param) {
 		TriMesh *mesh2 = TriMesh::read(info_param);
 		if (!mesh2)
@@ -10,7 +10,7 @@ Apply procedural shaders to a mesh
 #include "TriMesh_algo.h"
 #include "strutil.h"
 #include "KDtree.h"
-#include "lineqn.h"
+#include "BVH.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -210,92 +210,6 @@ void bdyshade(TriMesh *mesh, const char *nedges_)
 }
 
 
-// Helper for dist2mesh:
-// Find closest point to p on segment from v0 to v1
-point closest_on_segment(const point &v0, const point &v1, const point &p)
-{
-	vec v01 = v1 - v0;
-	float d = (p - v0) DOT v01;
-	d /= len2(v01);
-	if (d < 0.0f)
-		d = 0.0f;
-	else if (d > 1.0f)
-		d = 1.0f;
-	return v0 + d * v01;
-}
-
-
-// Helper for dist2mesh:
-// Find closest point to p on face i of mesh
-point closest_on_face(const TriMesh *mesh, int i, const point &p)
-{
-	const TriMesh::Face &f = mesh->faces[i];
-	const point &v0 = mesh->vertices[f[0]];
-	const point &v1 = mesh->vertices[f[1]];
-	const point &v2 = mesh->vertices[f[2]];
-	vec a = v1 - v0, b = v2 - v0, p1 = p - v0, n = a CROSS b;
-
-	float A[3][3] = { { a[0], b[0], n[0] },
-	                  { a[1], b[1], n[1] },
-	                  { a[2], b[2], n[2] } };
-	float x[3] = { p1[0], p1[1], p1[2] };
-	int indx[3];
-	ludcmp<float,3>(A, indx);
-	lubksb<float,3>(A, indx, x);
-
-	if (x[0] >= 0.0f && x[1] >= 0.0f && x[0] + x[1] <= 1.0f)
-		return v0 + x[0] * a + x[1] * b;
-
-	point c01 = closest_on_segment(v0, v1, p);
-	point c12 = closest_on_segment(v1, v2, p);
-	point c20 = closest_on_segment(v2, v0, p);
-	float d01 = dist2(c01, p);
-	float d12 = dist2(c12, p);
-	float d20 = dist2(c20, p);
-	if (d01 < d12) {
-		if (d01 < d20) return c01; else return c20;
-	} else {
-		if (d12 < d20) return c12; else return c20;
-	}
-}
-
-
-// Helper for dist2mesh:
-// Find (good approximation to) closest point on mesh to p.
-// Finds closest vertex, then checks all faces that touch it.
-bool find_closest_pt(const TriMesh *mesh, const KDtree *kd, const point &p,
-                     float maxdist2, point &pmatch)
-{
-	// const float *match = kd->closest_to_pt(p, maxdist2);
-	// The closest vertex might be much further away than the closest
-	// point on the surface.  So, we need to be conservative here.
-	const float *match = kd->closest_to_pt(p, 100.0f * maxdist2);
-	if (!match)
-		return false;
-	int ind = (match - (const float *) &(mesh->vertices[0][0])) / 3;
-	int nv = mesh->vertices.size();
-	if (ind < 0 || ind >= nv)
-		return false;
-
-	const vector<int> &a = mesh->adjacentfaces[ind];
-	if (a.empty()) {
-		pmatch = mesh->vertices[ind];
-		return true;
-	}
-
-	float closest_dist2 = maxdist2;
-	for (size_t i = 0; i < a.size(); i++) {
-		point c = closest_on_face(mesh, a[i], p);
-		float this_dist2 = dist2(c, p);
-		if (this_dist2 < closest_dist2) {
-			closest_dist2 = this_dist2;
-			pmatch = c;
-		}
-	}
-	return (closest_dist2 != maxdist2);
-}
-
-
 // Color by distance to another mesh
 void dist2mesh(TriMesh *mesh, const char *filename, const char *maxdist_)
 {
@@ -304,8 +218,7 @@ void dist2mesh(TriMesh *mesh, const char *filename, const char *maxdist_)
 		TriMesh::eprintf("Couldn't read %s\n", filename);
 		exit(1);
 	}
-	othermesh->need_adjacentfaces();
-	KDtree *kd = new KDtree(othermesh->vertices);
+	BVH *bvh = new BVH(othermesh);
 
 	float maxdist = ATOF(maxdist_);
 	float maxdist2 = sqr(maxdist);
@@ -314,17 +227,17 @@ void dist2mesh(TriMesh *mesh, const char *filename, const char *maxdist_)
 #pragma omp parallel for
 	for (int i = 0; i < nv; i++) {
 		const point &p = mesh->vertices[i];
-		point pmatch;
+		BVH::SurfacePoint match;
 		float d = maxdist;
-		if (find_closest_pt(othermesh, kd, p, maxdist2, pmatch))
-			d = dist(p, pmatch);
+		if (bvh->closest_pt(p, match, maxdist2))
+			d = sqrt(match.dist2);
 		d /= maxdist;
 		float H = 4.0f * (1.0f - d);
 		float S = 0.7f + 0.3f * d;
 		float V = 0.7f + 0.3f * d;
 		mesh->colors[i] = Color::hsv(H,S,V);
 	}
-	delete kd;
+	delete bvh;
 	delete othermesh;
 }
 
@@ -0,0 +1,366 @@
+/*
+trimesh_test.cc
+Consistency checks for the connectivity structures and the edits that
+update them in place.  Prints each failed check, and exits with nonzero
+status if there were any.
+*/
+
+#include "TriMesh.h"
+#include "CornerTable.h"
+#include "OneRing.h"
+#include "BVH.h"
+#include "TriMesh_algo.h"
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+using namespace std;
+using namespace trimesh;
+
+
+static int nfailed = 0;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAILED: %s:%d: ", __FILE__, __LINE__); \
+			fprintf(stderr, __VA_ARGS__); \
+			fprintf(stderr, "\n"); \
+			nfailed++; \
+		} \
+	} while (0)
+
+
+// A grid of n x n quads, each split into two triangles.  If wrap is
+// true, the grid is closed up into a torus.
+static TriMesh *make_grid(int n, bool wrap)
+{
+	TriMesh *mesh = new TriMesh;
+	int nvx = wrap ? n : n + 1;
+	for (int i = 0; i < nvx; i++)
+		for (int j = 0; j < nvx; j++)
+			mesh->vertices.push_back(point(float(i), float(j),
+				0.1f * float((i * 7 + j * 3) % 5)));
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			int i1 = (i + 1) % nvx, j1 = (j + 1) % nvx;
+			int a = i * nvx + j, b = i1 * nvx + j;
+			int c = i1 * nvx + j1, d = i * nvx + j1;
+			mesh->faces.push_back(TriMesh::Face(a, b, c));
+			mesh->faces.push_back(TriMesh::Face(a, c, d));
+		}
+	}
+	return mesh;
+}
+
+
+// Simple deterministic random numbers
+static unsigned rnd(unsigned n)
+{
+	static unsigned state = 12345;
+	state = state * 1664525u + 1013904223u;
+	return (state >> 8) % n;
+}
+
+
+// Check that the corner table's opposites pair up and agree with the
+// faces: opp[opp[c]] == c, and the two corners face the same edge.
+static void check_corner_table(const CornerTable &ct, const TriMesh *mesh,
+                               const char *when)
+{
+	int nc = ct.ncorners();
+	for (int c = 0; c < nc; c++) {
+		if (ct.is_deleted(CornerTable::face(c)))
+			continue;
+		int o = ct.opposite(c);
+		if (o < 0)
+			continue;
+		CHECK(o < nc && !ct.is_deleted(CornerTable::face(o)),
+			"%s: corner %d is opposite deleted corner %d", when, c, o);
+		if (o >= nc || ct.is_deleted(CornerTable::face(o)))
+			continue;
+		CHECK(ct.opposite(o) == c,
+			"%s: opp[opp[%d]] = %d", when, c, ct.opposite(o));
+		CHECK(ct.vertex(CornerTable::next(c)) ==
+		      ct.vertex(CornerTable::prev(o)) &&
+		      ct.vertex(CornerTable::prev(c)) ==
+		      ct.vertex(CornerTable::next(o)),
+			"%s: corners %d and %d face different edges", when, c, o);
+	}
+
+	int nv = mesh->vertices.size();
+	for (int v = 0; v < nv; v++) {
+		int c = ct.corner(v);
+		if (c < 0)
+			continue;
+		CHECK(!ct.is_deleted(CornerTable::face(c)) && ct.vertex(c) == v,
+			"%s: corner(%d) = %d is not a corner of it", when, v, c);
+	}
+}
+
+
+// Random flips, splits, and collapses, checking the table after each,
+// then compaction, comparing against a freshly built table
+static void test_corner_table(bool wrap)
+{
+	const char *name = wrap ? "torus" : "grid";
+	TriMesh *mesh = make_grid(12, wrap);
+	CornerTable ct(mesh);
+	check_corner_table(ct, mesh, name);
+
+	char when[64];
+	int nflips = 0, nsplits = 0, ncollapses = 0;
+	for (int iter = 0; iter < 300; iter++) {
+		int c = rnd(ct.ncorners());
+		if (ct.is_deleted(CornerTable::face(c)))
+			continue;
+		const point &p1 = mesh->vertices[ct.vertex(CornerTable::next(c))];
+		const point &p2 = mesh->vertices[ct.vertex(CornerTable::prev(c))];
+		point mid = 0.5f * (p1 + p2);
+		switch (rnd(3)) {
+			case 0:
+				nflips += ct.flip(c);
+				sprintf(when, "%s flip %d", name, iter);
+				break;
+			case 1:
+				ct.split(c, mid);
+				nsplits++;
+				sprintf(when, "%s split %d", name, iter);
+				break;
+			default:
+				ncollapses += ct.collapse(c, mid);
+				sprintf(when, "%s collapse %d", name, iter);
+				break;
+		}
+		check_corner_table(ct, mesh, when);
+	}
+	CHECK(ct.up_to_date(), "%s: table out of date after its own edits",
+		name);
+	CHECK(nflips && nsplits && ncollapses,
+		"%s: only %d flips, %d splits, %d collapses", name,
+		nflips, nsplits, ncollapses);
+
+	ct.compact();
+	sprintf(when, "%s compact", name);
+	check_corner_table(ct, mesh, when);
+
+	CornerTable fresh(mesh);
+	CHECK(fresh.ncorners() == ct.ncorners(),
+		"%s: %d corners after compact, %d in rebuilt table", name,
+		ct.ncorners(), fresh.ncorners());
+	if (fresh.ncorners() == ct.ncorners()) {
+		int nc = ct.ncorners(), ndiff = 0;
+		for (int c = 0; c < nc; c++)
+			ndiff += (ct.opposite(c) != fresh.opposite(c));
+		CHECK(!ndiff, "%s: %d opposites differ from rebuilt table",
+			name, ndiff);
+	}
+	delete mesh;
+}
+
+
+// Structures built from a mesh notice when it changes
+static void test_generations()
+{
+	TriMesh *mesh = make_grid(4, false);
+	CornerTable ct(mesh);
+	BVH bvh(mesh);
+	CHECK(ct.up_to_date() && bvh.up_to_date(mesh),
+		"generations: out of date when just built");
+
+	mesh->need_normals();
+	mesh->need_bbox();
+	trans(mesh, vec(1, 0, 0));
+	CHECK(ct.up_to_date(), "generations: table stale after moving");
+	CHECK(!bvh.up_to_date(mesh), "generations: BVH current after moving");
+	CHECK(!mesh->normals.empty() && mesh->bbox.valid,
+		"generations: apply_xform dropped normals or bbox");
+
+	mesh->need_adjacentfaces();
+	mesh->need_across_edge();
+	orient(mesh);
+	CHECK(!ct.up_to_date(), "generations: table current after orient");
+	CHECK(!mesh->adjacentfaces.empty() && mesh->across_edge.empty(),
+		"generations: orient cleared the wrong connectivity");
+	delete mesh;
+}
+
+
+// OneRing visits the same faces and neighbors as adjacentfaces and
+// neighbors list, in order around the vertex
+static void test_one_ring(bool wrap)
+{
+	const char *name = wrap ? "ring torus" : "ring grid";
+	TriMesh *mesh = make_grid(6, wrap);
+	mesh->need_neighbors();
+	mesh->need_adjacentfaces();
+	mesh->need_across_edge();
+	mesh->need_edges();
+	int nv = mesh->vertices.size();
+	for (int v = 0; v < nv; v++) {
+		OneRing ring(mesh, v);
+		CHECK(ring.is_bdy() == mesh->is_bdy(v),
+			"%s: vertex %d boundary mismatch", name, v);
+
+		vector<int> faces, verts, edges;
+		int last = -1;
+		for (OneRing::Corner c : ring) {
+			CHECK(mesh->faces[c.face][c.corner] == v,
+				"%s: face %d does not touch vertex %d", name,
+				c.face, v);
+			CHECK(last < 0 || c.next == last,
+				"%s: faces around vertex %d out of order", name, v);
+			last = c.prev;
+			faces.push_back(c.face);
+		}
+		for (int n : ring.vertices())
+			verts.push_back(n);
+		for (int e : ring.edges())
+			edges.push_back(e);
+
+		CHECK(verts.size() == edges.size(),
+			"%s: vertex %d has %d neighbors but %d edges", name, v,
+			int(verts.size()), int(edges.size()));
+		for (size_t k = 0; k < verts.size() && k < edges.size(); k++) {
+			const TriMesh::Edge &e = mesh->edges[edges[k]];
+			CHECK((e[0] == v && e[1] == verts[k]) ||
+			      (e[1] == v && e[0] == verts[k]),
+				"%s: edge %d does not join %d and %d", name,
+				edges[k], v, verts[k]);
+		}
+
+		sort(faces.begin(), faces.end());
+		sort(verts.begin(), verts.end());
+		Adjacency::const_range a = mesh->adjacentfaces[v];
+		Adjacency::const_range n = mesh->neighbors[v];
+		CHECK(faces.size() == a.size() &&
+		      equal(faces.begin(), faces.end(), a.begin()),
+			"%s: faces around vertex %d differ from adjacentfaces",
+			name, v);
+		CHECK(verts.size() == n.size() &&
+		      equal(verts.begin(), verts.end(), n.begin()),
+			"%s: vertices around vertex %d differ from neighbors",
+			name, v);
+	}
+	delete mesh;
+}
+
+
+// Do two adjacency lists match?
+static bool same_adjacency(const Adjacency &a1, const Adjacency &a2)
+{
+	if (a1.size() != a2.size())
+		return false;
+	for (size_t i = 0; i < a1.size(); i++) {
+		Adjacency::const_range r1 = a1[i], r2 = a2[i];
+		if (r1.size() != r2.size() ||
+		    !equal(r1.begin(), r1.end(), r2.begin()))
+			return false;
+	}
+	return true;
+}
+
+
+// Compare the connectivity kept up to date by remap_verts against what
+// is computed from scratch
+static void check_remapped(TriMesh *mesh, const char *when)
+{
+	TriMesh fresh;
+	fresh.vertices = mesh->vertices;
+	fresh.faces = mesh->faces;
+	fresh.need_neighbors();
+	fresh.need_adjacentfaces();
+	fresh.need_across_edge();
+	CHECK(same_adjacency(mesh->neighbors, fresh.neighbors),
+		"%s: neighbors differ from recomputed", when);
+	CHECK(same_adjacency(mesh->adjacentfaces, fresh.adjacentfaces),
+		"%s: adjacentfaces differ from recomputed", when);
+	CHECK(mesh->across_edge == fresh.across_edge,
+		"%s: across_edge differs from recomputed", when);
+}
+
+
+// remap_verts with a one-to-one table, and one that merges vertices
+static void test_remap_verts()
+{
+	TriMesh *mesh = make_grid(8, false);
+	mesh->need_neighbors();
+	mesh->need_adjacentfaces();
+	mesh->need_across_edge();
+	int nv = mesh->vertices.size(), gone = 40;
+	vector<int> remap(nv);
+	for (int i = 0; i < nv; i++)
+		remap[i] = (i == gone) ? -1 : nv - 1 - i - (i < gone);
+	remap_verts(mesh, remap);
+	check_remapped(mesh, "remap one-to-one");
+	delete mesh;
+
+	// Two separate triangles, glued together along an edge
+	mesh = new TriMesh;
+	mesh->vertices.push_back(point(0, 0, 0));
+	mesh->vertices.push_back(point(1, 0, 0));
+	mesh->vertices.push_back(point(0, 1, 0));
+	mesh->vertices.push_back(point(0, 1, 0));
+	mesh->vertices.push_back(point(1, 0, 0));
+	mesh->vertices.push_back(point(1, 1, 0));
+	mesh->faces.push_back(TriMesh::Face(0, 1, 2));
+	mesh->faces.push_back(TriMesh::Face(3, 4, 5));
+	mesh->need_neighbors();
+	mesh->need_adjacentfaces();
+	mesh->need_across_edge();
+	int merge[] = { 0, 1, 2, 2, 1, 3 };
+	remap.assign(merge, merge + 6);
+	remap_verts(mesh, remap);
+	check_remapped(mesh, "remap merging");
+	CHECK(mesh->across_edge[0][0] == 1,
+		"remap merging: faces not joined");
+	delete mesh;
+
+	// Merging moves face corners, so cached face areas must follow
+	mesh = new TriMesh;
+	mesh->vertices.push_back(point(0, 0, 0));
+	mesh->vertices.push_back(point(1, 0, 0));
+	mesh->vertices.push_back(point(0, 1, 0));
+	mesh->vertices.push_back(point(3, 0, 0));
+	mesh->vertices.push_back(point(3, 1, 0));
+	mesh->vertices.push_back(point(5, 5, 0));
+	mesh->faces.push_back(TriMesh::Face(0, 1, 2));
+	mesh->faces.push_back(TriMesh::Face(3, 4, 5));
+	mesh->need_facenormals();
+	mesh->need_faceareas();
+	int merge2[] = { 0, 1, 2, 3, 4, 2 };
+	remap.assign(merge2, merge2 + 6);
+	remap_verts(mesh, remap);
+	TriMesh fresh;
+	fresh.vertices = mesh->vertices;
+	fresh.faces = mesh->faces;
+	float area = mesh->stat(TriMesh::STAT_SUM, TriMesh::STAT_FACEAREA);
+	float fresh_area = fresh.stat(TriMesh::STAT_SUM, TriMesh::STAT_FACEAREA);
+	CHECK(fabs(area - fresh_area) < 1.0e-5f * fresh_area,
+		"remap merging: face area %g, recomputed %g", area, fresh_area);
+	mesh->need_facenormals();
+	fresh.need_facenormals();
+	CHECK(mesh->facenormals == fresh.facenormals,
+		"remap merging: face normals differ from recomputed");
+	delete mesh;
+}
+
+
+int main()
+{
+	TriMesh::set_verbose(0);
+
+	test_corner_table(false);
+	test_corner_table(true);
+	test_one_ring(false);
+	test_one_ring(true);
+	test_generations();
+	test_remap_verts();
+
+	if (nfailed) {
+		fprintf(stderr, "%d checks failed\n", nfailed);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}